@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "constant-pool.hpp"
+#include "method-descriptor.hpp"
+#include "method-info.hpp"
+#include "typedefs.hpp"
+#include <cassert>
+#include <cstddef>
+
+namespace fish::java {
+    /**
+     * An `invokestatic` instruction whose target is resolved the first
+     * time it executes, so later calls need no constant pool lookups or
+     * descriptor parsing.
+     */
+    class CallSite {
+        public:
+        explicit CallSite(u16 index) : m_index(index) {
+        }
+
+        // Constant pool index of the method reference.
+        u16 index() const {
+            return m_index;
+        }
+
+        bool resolved() const {
+            return m_method;
+        }
+
+        void resolve(const MethodInfo& method, const ConstantPool& cpool) {
+            MethodDescriptor mdesc = method.descriptor(cpool);
+            m_method = &method;
+            m_nargs = mdesc.nargs();
+            m_nreturn = mdesc.nreturn();
+        }
+
+        const MethodInfo& method() const {
+            assert(m_method);
+            return *m_method;
+        }
+
+        std::size_t nargs() const {
+            return m_nargs;
+        }
+
+        std::size_t nreturn() const {
+            return m_nreturn;
+        }
+
+        private:
+        u16 m_index = 0;
+        const MethodInfo* m_method = nullptr;
+        std::size_t m_nargs = 0;
+        std::size_t m_nreturn = 0;
+    };
+
+    struct CallSiteStats {
+        // Calls through an already-resolved call site.
+        u64 hits = 0;
+
+        // Calls that had to resolve their call site.
+        u64 misses = 0;
+    };
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "frame-arena.hpp"
+#include "method-info.hpp"
+#include "typedefs.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace fish::java {
+    class StackOverflowError : public std::runtime_error {
+        public:
+        StackOverflowError() : std::runtime_error("Stack overflow") {
+        }
+    };
+
+    /**
+     * An interpreter frame. Locals and the operand stack live in a
+     * FrameArena; `Pc` is the type the interpreter uses to record where
+     * execution resumes after a call returns.
+     */
+    template <typename Pc>
+    class CallFrame {
+        public:
+        CallFrame(
+            const MethodInfo& method, u32* locals, FrameArena::Mark mark
+        ) :
+        m_method(&method),
+        m_locals(locals),
+        m_sp(stack()),
+        m_mark(mark) {
+        }
+
+        const MethodInfo& method() const {
+            return *m_method;
+        }
+
+        const CodeInfo& code_info() const {
+            return m_method->code;
+        }
+
+        u32* locals() {
+            return m_locals;
+        }
+
+        u32& local(std::size_t i) {
+            assert(i < code_info().max_locals);
+            return m_locals[i];
+        }
+
+        // Bottom of the operand stack.
+        u32* stack() {
+            return m_locals + code_info().max_locals;
+        }
+
+        // Top of the operand stack. Interpreters that keep the stack
+        // pointer elsewhere must store it here before making a call.
+        u32*& sp() {
+            return m_sp;
+        }
+
+        void push(u32 val) {
+            assert(m_sp < stack() + code_info().max_stack);
+            *m_sp++ = val;
+        }
+
+        u32 pop() {
+            assert(m_sp > stack());
+            return *--m_sp;
+        }
+
+        Pc& pc() {
+            return m_pc;
+        }
+
+        const FrameArena::Mark& mark() const {
+            return m_mark;
+        }
+
+        private:
+        const MethodInfo* m_method = nullptr;
+        u32* m_locals = nullptr;
+        u32* m_sp = nullptr;
+        Pc m_pc = {};
+        FrameArena::Mark m_mark;
+    };
+
+    /**
+     * Explicit stack of interpreter frames, so that Java calls don't
+     * consume native stack space.
+     */
+    template <typename Pc>
+    class CallStack {
+        public:
+        using Frame = CallFrame<Pc>;
+
+        CallStack(FrameArena& arena, std::size_t max_depth) :
+        m_arena(arena), m_max_depth(max_depth) {
+        }
+
+        CallStack(const CallStack&) = delete;
+        CallStack& operator=(const CallStack&) = delete;
+
+        ~CallStack() {
+            if (!empty()) {
+                m_arena.release(m_frames.front().mark());
+            }
+        }
+
+        // NOTE: Invalidates references to other frames.
+        Frame& push(const MethodInfo& method) {
+            if (m_frames.size() >= m_max_depth) {
+                throw StackOverflowError();
+            }
+            const CodeInfo& code_info = method.code;
+            FrameArena::Mark mark = m_arena.mark();
+            u32* locals = m_arena.allocate(
+                code_info.max_locals + code_info.max_stack
+            );
+            std::fill_n(locals, code_info.max_locals, 0);
+            return m_frames.emplace_back(method, locals, mark);
+        }
+
+        void pop() {
+            assert(!empty());
+            m_arena.release(m_frames.back().mark());
+            m_frames.pop_back();
+        }
+
+        Frame& top() {
+            assert(!empty());
+            return m_frames.back();
+        }
+
+        bool empty() const {
+            return m_frames.empty();
+        }
+
+        std::size_t size() const {
+            return m_frames.size();
+        }
+
+        private:
+        FrameArena& m_arena;
+        std::size_t m_max_depth = 0;
+        std::vector<Frame> m_frames;
+    };
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace fish::java {
+    /**
+     * Bump allocator for the IR nodes of one compilation. Memory is carved
+     * out of large chunks and freed all at once when the arena is
+     * destroyed, so anything allocated from it must not outlive it.
+     *
+     * ArenaAllocator uses the arena that is current (see Scope) when a
+     * container is created, or the heap if there is none.
+     */
+    class Arena {
+        public:
+        // Size of each chunk. Larger allocations get a chunk of their own.
+        static constexpr std::size_t chunk_size = 64 * 1024;
+
+        // Makes an arena current until the scope ends.
+        class Scope {
+            public:
+            explicit Scope(Arena& arena) : m_prev(s_current) {
+                s_current = &arena;
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope() {
+                s_current = m_prev;
+            }
+
+            private:
+            Arena* m_prev = nullptr;
+        };
+
+        Arena() = default;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        static Arena* current() {
+            return s_current;
+        }
+
+        void* allocate(std::size_t size, std::size_t align) {
+            auto top = reinterpret_cast<std::uintptr_t>(m_top);
+            top = (top + align - 1) & ~(align - 1);
+            const auto end = reinterpret_cast<std::uintptr_t>(m_end);
+            if (!m_top || top + size > end) {
+                next_chunk(size + align);
+                top = reinterpret_cast<std::uintptr_t>(m_top);
+                top = (top + align - 1) & ~(align - 1);
+            }
+            std::byte* result = reinterpret_cast<std::byte*>(top);
+            m_top = result + size;
+            return result;
+        }
+
+        private:
+        static inline thread_local Arena* s_current = nullptr;
+        std::vector<std::unique_ptr<std::byte[]>> m_chunks;
+        std::byte* m_top = nullptr;
+        std::byte* m_end = nullptr;
+
+        void next_chunk(std::size_t min_size) {
+            const std::size_t size = std::max(chunk_size, min_size);
+            m_chunks.push_back(std::make_unique<std::byte[]>(size));
+            m_top = m_chunks.back().get();
+            m_end = m_top + size;
+        }
+    };
+
+    template <typename T>
+    class ArenaAllocator {
+        public:
+        using value_type = T;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        ArenaAllocator() : m_arena(Arena::current()) {
+        }
+
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) :
+        m_arena(other.arena()) {
+        }
+
+        // Copies of containers use the current arena.
+        ArenaAllocator select_on_container_copy_construction() const {
+            return ArenaAllocator();
+        }
+
+        T* allocate(std::size_t n) {
+            if (!m_arena) {
+                return std::allocator<T>().allocate(n);
+            }
+            return static_cast<T*>(
+                m_arena->allocate(n * sizeof(T), alignof(T))
+            );
+        }
+
+        void deallocate(T* ptr, std::size_t n) {
+            // Arena memory is freed when the arena is destroyed.
+            if (!m_arena) {
+                std::allocator<T>().deallocate(ptr, n);
+            }
+        }
+
+        Arena* arena() const {
+            return m_arena;
+        }
+
+        template <typename U>
+        bool operator==(const ArenaAllocator<U>& other) const {
+            return m_arena == other.arena();
+        }
+
+        template <typename U>
+        bool operator!=(const ArenaAllocator<U>& other) const {
+            return !(*this == other);
+        }
+
+        private:
+        Arena* m_arena = nullptr;
+    };
+
+    template <typename T>
+    using ArenaList = std::list<T, ArenaAllocator<T>>;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "../typedefs.hpp"
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace fish::java {
+    /**
+     * A set of integers less than a fixed size, stored as packed bits so
+     * that unions and differences work a word at a time.
+     */
+    class BitSet {
+        using Word = u64;
+        static constexpr std::size_t word_bits = 64;
+
+        public:
+        BitSet() = default;
+
+        explicit BitSet(std::size_t size) :
+        m_words((size + word_bits - 1) / word_bits) {
+        }
+
+        bool test(std::size_t index) const {
+            return (word(index) >> (index % word_bits)) & 1;
+        }
+
+        void set(std::size_t index) {
+            word(index) |= Word(1) << (index % word_bits);
+        }
+
+        void reset(std::size_t index) {
+            word(index) &= ~(Word(1) << (index % word_bits));
+        }
+
+        // Adds every element of `other`. Returns whether any were new.
+        bool merge(const BitSet& other) {
+            assert(m_words.size() == other.m_words.size());
+            Word changed = 0;
+            for (std::size_t i = 0; i < m_words.size(); ++i) {
+                const Word next = m_words[i] | other.m_words[i];
+                changed |= next ^ m_words[i];
+                m_words[i] = next;
+            }
+            return changed != 0;
+        }
+
+        // Removes every element of `other`.
+        void subtract(const BitSet& other) {
+            assert(m_words.size() == other.m_words.size());
+            for (std::size_t i = 0; i < m_words.size(); ++i) {
+                m_words[i] &= ~other.m_words[i];
+            }
+        }
+
+        // Calls `func` with each element, in increasing order.
+        template <typename Func>
+        void for_each(Func&& func) const {
+            for (std::size_t i = 0; i < m_words.size(); ++i) {
+                for (Word bits = m_words[i]; bits != 0; bits &= bits - 1) {
+                    func(i * word_bits + __builtin_ctzll(bits));
+                }
+            }
+        }
+
+        bool operator==(const BitSet& other) const {
+            return m_words == other.m_words;
+        }
+
+        bool operator!=(const BitSet& other) const {
+            return !(*this == other);
+        }
+
+        private:
+        std::vector<Word> m_words;
+
+        Word& word(std::size_t index) {
+            assert(index / word_bits < m_words.size());
+            return m_words[index / word_bits];
+        }
+
+        Word word(std::size_t index) const {
+            return const_cast<BitSet&>(*this).word(index);
+        }
+    };
+}
@@ -19,17 +19,21 @@
 
 #pragma once
 #include "ssa.hpp"
+#include <algorithm>
+#include <cstddef>
 #include <list>
 #include <map>
 #include <stdexcept>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace fish::java::ssa {
     class UnlinkedValue {
         public:
-        UnlinkedValue(Variable var, Value& value) :
+        UnlinkedValue(Variable var, Use& value) :
         m_var(var), m_value(&value) {
         }
 
@@ -37,153 +41,241 @@ namespace fish::java::ssa {
             return m_var;
         }
 
-        Value& value() {
+        Use& value() {
             assert(m_value);
             return *m_value;
         }
 
-        const Value& value() const {
+        const Use& value() const {
             return const_cast<UnlinkedValue&>(*this).value();
         }
 
         private:
         Variable m_var;
-        Value* m_value = nullptr;
+        Use* m_value = nullptr;
     };
 
     using DefMap = std::map<BasicBlock*, std::map<Variable, Value>>;
     using UnlinkedMap = std::map<BasicBlock*, std::list<UnlinkedValue>>;
 
+    /**
+     * The dominator tree of a function, built with the algorithm by
+     * Cooper, Harvey, and Kennedy ("A Simple, Fast Dominance Algorithm").
+     * Blocks are numbered in reverse postorder, and their nodes are kept
+     * in a vector by number, so dominance queries take constant time.
+     * Dominance frontiers are computed once up front.
+     */
     class Dominators {
         using Block = const BasicBlock;
         using BlockSet = std::set<Block*>;
 
         public:
         Dominators(const Function& func) {
-            initialize_sets(func);
-            while (step_all(func));
-
-            // FIXME: Debug
-            if constexpr (false) {
-                std::cout << "\n";
-                for (auto& block : func.blocks()) {
-                    auto& doms = m_dominators.at(&block);
-                    std::cout << block.id() << " is dominated by: ";
-                    for (auto dom : doms) {
-                        std::cout << dom->id() << ", ";
-                    }
-                    std::cout << "\n";
+            decltype(auto) blocks = func.blocks();
+            if (blocks.begin() == blocks.end()) {
+                return;
+            }
+            number(*blocks.begin());
+            find_idoms();
+
+            // Unreachable blocks are dominated only by themselves.
+            for (Block& block : blocks) {
+                if (m_index.count(&block) == 0) {
+                    m_index.emplace(&block, m_order.size());
+                    m_order.push_back(&block);
+                    m_nodes.emplace_back();
                 }
-                std::cout << "\n";
+            }
 
-                for (auto& block : func.blocks()) {
-                    std::cout << block.id() << " has frontiers: ";
-                    for (auto front : frontiers(block)) {
-                        std::cout << front->id() << ", ";
-                    }
-                    std::cout << "\n";
+            for (std::size_t i = 0; i < m_nodes.size(); ++i) {
+                const std::size_t parent = m_nodes[i].idom;
+                if (parent != none) {
+                    m_nodes[parent].children.push_back(m_order[i]);
                 }
-                std::cout << "\n";
             }
+            number_tree();
+            find_frontiers();
+        }
+
+        // The immediate dominator of `block`, or null if it has none.
+        Block* idom(Block& block) const {
+            const std::size_t parent = node(block).idom;
+            return parent == none ? nullptr : m_order[parent];
+        }
+
+        // Reachable blocks in reverse postorder, so each block comes after
+        // its immediate dominator, then unreachable blocks.
+        const std::vector<Block*>& order() const {
+            return m_order;
+        }
+
+        // The blocks whose immediate dominator is `block`.
+        const std::vector<Block*>& children(Block& block) const {
+            return node(block).children;
         }
 
-        bool dominates(Block& dom, Block& other) {
-            return m_dominators.at(&other).count(&dom) > 0;
+        bool dominates(Block& dom, Block& other) const {
+            const Node& dom_node = node(dom);
+            const Node& other_node = node(other);
+            return (
+                dom_node.pre <= other_node.pre &&
+                other_node.post <= dom_node.post
+            );
         }
 
-        bool strictly_dominates(Block& dom, Block& other) {
+        bool strictly_dominates(Block& dom, Block& other) const {
             return &dom != &other && dominates(dom, other);
         }
 
-        bool frontier(Block& block, Block& front) {
-            if (strictly_dominates(block, front)) {
-                return false;
-            }
-            for (Block* pred : front.predecessors()) {
-                if (dominates(block, *pred)) {
-                    return true;
-                }
-            }
-            return false;
+        bool frontier(Block& block, Block& front) const {
+            return frontiers(block).count(&front) > 0;
         }
 
-        std::set<Block*> frontiers(Block& block) {
-            std::set<Block*> result;
-            for (auto& pair : m_dominators) {
-                Block* front = pair.first;
-                if (frontier(block, *front)) {
-                    result.insert(front);
-                }
-            }
-            return result;
+        const BlockSet& frontiers(Block& block) const {
+            return node(block).frontiers;
         }
 
         private:
-        std::map<Block*, std::set<Block*>> m_dominators;
+        static constexpr std::size_t none = -1;
+
+        struct Node {
+            // Number of the immediate dominator, or `none`.
+            std::size_t idom = none;
+            std::vector<Block*> children;
+            BlockSet frontiers;
 
-        void initialize_sets(const Function& func) {
-            auto it = func.blocks().begin();
-            auto end = func.blocks().end();
+            // Preorder and postorder indices in the dominator tree.
+            std::size_t pre = 0;
+            std::size_t post = 0;
+        };
 
-            Block& start = *it;
-            m_dominators[&start].insert(&start);
-            ++it;
+        // Nodes by block number: the block's index in `m_order`.
+        std::vector<Node> m_nodes;
+        std::unordered_map<Block*, std::size_t> m_index;
 
-            std::set<Block*> all_blocks;
-            for (Block& block : func.blocks()) {
-                all_blocks.insert(&block);
+        // Reachable blocks in reverse postorder, then unreachable blocks.
+        std::vector<Block*> m_order;
+
+        const Node& node(Block& block) const {
+            return m_nodes[m_index.at(&block)];
+        }
+
+        // Numbers the blocks reachable from `entry` in reverse postorder.
+        void number(Block& entry) {
+            std::vector<std::pair<Block*, bool>> stack;
+            std::unordered_set<Block*> visited;
+            stack.emplace_back(&entry, false);
+            while (!stack.empty()) {
+                auto [block, done] = stack.back();
+                stack.pop_back();
+                if (done) {
+                    m_order.push_back(block);
+                    continue;
+                }
+                if (!visited.insert(block).second) continue;
+                stack.emplace_back(block, true);
+                for (Block* succ : block->successors()) {
+                    if (visited.count(succ) == 0) {
+                        stack.emplace_back(succ, false);
+                    }
+                }
             }
 
-            for (; it != end; ++it) {
-                Block& block = *it;
-                m_dominators[&block] = all_blocks;
+            std::reverse(m_order.begin(), m_order.end());
+            m_nodes.resize(m_order.size());
+            for (std::size_t i = 0; i < m_order.size(); ++i) {
+                m_index.emplace(m_order[i], i);
             }
         }
 
-        bool step_all(const Function& func) {
-            auto it = ++func.blocks().begin();
-            auto end = func.blocks().end();
-            bool changed = false;
-            for (; it != end; ++it) {
-                Block& block = *it;
-                changed |= step_one(block);
+        void find_idoms() {
+            // The numbers of each block's reachable predecessors.
+            std::vector<std::vector<std::size_t>> preds(m_order.size());
+            for (std::size_t i = 0; i < m_order.size(); ++i) {
+                for (Block* pred : m_order[i]->predecessors()) {
+                    auto it = m_index.find(pred);
+                    if (it != m_index.end()) {
+                        preds[i].push_back(it->second);
+                    }
+                }
             }
-            return changed;
-        }
 
-        bool step_one(Block& block) {
-            auto it = block.predecessors().begin();
-            auto end = block.predecessors().end();
+            // Temporarily makes the entry its own dominator.
+            m_nodes[0].idom = 0;
+
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (std::size_t i = 1; i < m_order.size(); ++i) {
+                    std::size_t next = none;
+                    for (std::size_t pred : preds[i]) {
+                        if (m_nodes[pred].idom == none) continue;
+                        next = next == none ? pred : intersect(pred, next);
+                    }
+
+                    Node& node = m_nodes[i];
+                    if (next != node.idom) {
+                        node.idom = next;
+                        changed = true;
+                    }
+                }
+            }
+            m_nodes[0].idom = none;
+        }
 
-            std::set<Block*> next;
-            if (it != end) {
-                Block* pred = *(it++);
-                next = m_dominators.at(pred);
+        // Block numbers are reverse postorder indices.
+        std::size_t intersect(std::size_t block1, std::size_t block2) const {
+            while (block1 != block2) {
+                while (block1 > block2) {
+                    block1 = m_nodes[block1].idom;
+                }
+                while (block2 > block1) {
+                    block2 = m_nodes[block2].idom;
+                }
             }
+            return block1;
+        }
 
-            for (; it != end; ++it) {
-                Block* pred = *it;
-                intersect(next, m_dominators.at(pred));
+        void number_tree() {
+            std::size_t counter = 0;
+            std::vector<std::pair<std::size_t, bool>> stack;
+            for (std::size_t i = m_nodes.size(); i-- > 0;) {
+                if (m_nodes[i].idom == none) {
+                    stack.emplace_back(i, false);
+                }
             }
 
-            next.insert(&block);
-            auto& current = m_dominators.at(&block);
-            if (next == current) {
-                return false;
+            while (!stack.empty()) {
+                auto [index, done] = stack.back();
+                stack.pop_back();
+                Node& node = m_nodes[index];
+                if (done) {
+                    node.post = counter++;
+                    continue;
+                }
+                node.pre = counter++;
+                stack.emplace_back(index, true);
+                for (Block* child : node.children) {
+                    stack.emplace_back(m_index.at(child), false);
+                }
             }
-            current = std::move(next);
-            return true;
         }
 
-        void intersect(BlockSet& dest, BlockSet& source) const {
-            auto it = dest.begin();
-            auto end = dest.end();
-            while (it != end) {
-                Block* block = *it;
-                if (source.count(block) <= 0) {
-                    dest.erase(it++);
-                } else {
-                    ++it;
+        // A block is in the frontier of every block that dominates one of
+        // its predecessors but doesn't strictly dominate the block itself.
+        // These are found by walking up the tree from each predecessor.
+        void find_frontiers() {
+            for (std::size_t i = 0; i < m_order.size(); ++i) {
+                Block* block = m_order[i];
+                const std::size_t parent = m_nodes[i].idom;
+                for (Block* pred : block->predecessors()) {
+                    auto it = m_index.find(pred);
+                    if (it == m_index.end()) continue;
+                    std::size_t runner = it->second;
+                    while (runner != none && runner != parent) {
+                        m_nodes[runner].frontiers.insert(block);
+                        runner = m_nodes[runner].idom;
+                    }
                 }
             }
         }
@@ -203,113 +295,98 @@ namespace fish::java::ssa {
         }
 
         void fix(Variable var) {
-            std::set<BasicBlock*> work_list;
-            std::set<BasicBlock*> has_phi;
-            std::vector<InstructionIterator> phis;
-            std::set<Instruction*> referenced_instructions;
-
+            // Phis go in the iterated dominance frontier of the blocks
+            // that define `var`.
+            std::map<BasicBlock*, InstructionIterator> phis;
+            std::vector<BasicBlock*> work_list;
             for (auto& block : m_func.blocks()) {
-                if (defines(block, var)) {
-                    work_list.insert(&block);
+                if (def(block, var)) {
+                    work_list.push_back(&block);
                 }
             }
 
-            std::set<BasicBlock*> done = work_list;
             while (!work_list.empty()) {
-                auto it = work_list.begin();
-                BasicBlock& block = **it;
-                work_list.erase(it);
-
+                BasicBlock& block = *work_list.back();
+                work_list.pop_back();
                 for (auto front_ptr : m_doms.frontiers(block)) {
                     BasicBlock& front = const_cast<BasicBlock&>(*front_ptr);
-                    if (has_phi.count(&front) > 0) {
+                    if (phis.count(&front) > 0) {
                         continue;
                     }
-
-                    auto phi = front.instructions().prepend(Phi());
-                    phis.push_back(phi);
-                    has_phi.insert(&front);
-
-                    // (var, phi) should be added to m_links, but this
-                    // is done later, after the possible removal of phi.
-                    //m_links[&front].emplace(var, phi);
-
-                    bool inserted = m_defs[&front].emplace(var, phi).second;
-                    if (inserted) {
-                        referenced_instructions.insert(&*phi);
+                    phis.emplace(&front, front.instructions().prepend(Phi()));
+                    if (!def(front, var)) {
+                        work_list.push_back(&front);
                     }
-
-                    if (done.count(&front) > 0) {
-                        continue;
-                    }
-                    work_list.insert(&front);
-                    done.insert(&front);
                 }
             }
 
-            for (auto& block : m_func.blocks()) {
-                if (has_phi.count(&block) > 0) {
-                    continue;
-                }
-
-                std::set<BasicBlock*> seen;
-                BasicBlock* pred = &block;
-                seen.insert(pred);
-                auto& links = m_links[&block];
-                auto& defs = m_defs[&block];
-
-                for (BasicBlock* next : pred->predecessors()) {
-                    if (seen.count(next) > 0) {
-                        continue;
+            // Values of `var` at the start and end of each block. A block
+            // without a phi sees the value from its immediate dominator.
+            // Phis with a predecessor where `var` is undefined are
+            // removed; valid bytecode never uses their values. Removing
+            // one can make others undefined, so this repeats until none
+            // are removed.
+            std::map<BasicBlock*, Value> in;
+            std::map<BasicBlock*, Value> out;
+            std::set<BasicBlock*> undefined;
+            while (true) {
+                in.clear();
+                out.clear();
+                for (auto block_ptr : m_doms.order()) {
+                    BasicBlock& block = const_cast<BasicBlock&>(*block_ptr);
+                    auto phi = phis.find(&block);
+                    auto idom = m_doms.idom(block);
+                    if (phi != phis.end()) {
+                        in.emplace(&block, phi->second);
                     }
-
-                    pred = next;
-                    auto& pred_defs = m_defs.at(pred);
-                    auto def_iter = pred_defs.find(var);
-                    if (def_iter == pred_defs.end()) {
-                        seen.insert(pred);
-                        continue;
+                    else if (idom && undefined.count(&block) == 0) {
+                        auto it = out.find(const_cast<BasicBlock*>(idom));
+                        if (it != out.end()) {
+                            in.emplace(&block, it->second);
+                        }
                     }
 
-                    Value& def = def_iter->second;
-                    if (auto inst = def.get_if<InstructionIterator>()) {
-                        referenced_instructions.insert(&**inst);
+                    if (const Value* value = def(block, var)) {
+                        out.emplace(&block, *value);
+                    }
+                    else if (auto it = in.find(&block); it != in.end()) {
+                        out.emplace(&block, it->second);
                     }
-
-                    links.emplace(var, def);
-                    defs.emplace(var, def);
-                    break;
                 }
-            }
 
-            for (auto inst : phis) {
-                Phi& phi = inst->get<Phi>();
-                auto& block = inst->block();
                 bool removed = false;
-
-                for (BasicBlock* pred : block.predecessors()) {
-                    auto& defs = m_defs.at(pred);
-                    auto it = defs.find(var);
-                    if (it != defs.end()) {
-                        auto& value = it->second;
-                        phi.emplace(*pred, value);
+                for (auto it = phis.begin(); it != phis.end();) {
+                    auto [block, inst] = *it;
+                    auto preds = block->predecessors();
+                    bool defined = std::all_of(
+                        preds.begin(), preds.end(),
+                        [&] (BasicBlock* pred) {
+                            return out.count(pred) > 0;
+                        }
+                    );
+                    if (defined) {
+                        ++it;
                         continue;
                     }
-
-                    // Remove unnecessary phi. No one should be using it.
-                    if (referenced_instructions.count(&*inst) > 0) {
-                        throw std::runtime_error("Unnecessary phi has uses");
-                    }
-
-                    block.instructions().erase(inst);
+                    block->instructions().erase(inst);
+                    undefined.insert(block);
+                    it = phis.erase(it);
                     removed = true;
+                }
+                if (!removed) {
                     break;
                 }
+            }
 
-                if (!removed) {
-                    m_links[&block].emplace(var, inst);
+            for (auto& [block, inst] : phis) {
+                Phi& phi = inst->get<Phi>();
+                for (BasicBlock* pred : block->predecessors()) {
+                    phi.emplace(*pred, out.at(pred));
                 }
             }
+            for (auto& [block, value] : in) {
+                m_links[block].emplace(var, value);
+            }
         }
 
         const std::map<Variable, Value>& links(BasicBlock& block) {
@@ -333,8 +410,17 @@ namespace fish::java::ssa {
             return result;
         }
 
-        bool defines(BasicBlock& block, Variable var) {
-            return m_defs.at(&block).count(var) > 0;
+        // The last definition of `var` in `block`, if any.
+        const Value* def(BasicBlock& block, Variable var) const {
+            auto it = m_defs.find(&block);
+            if (it == m_defs.end()) {
+                return nullptr;
+            }
+            auto def = it->second.find(var);
+            if (def == it->second.end()) {
+                return nullptr;
+            }
+            return &def->second;
         }
     };
 }
@@ -40,26 +40,47 @@ namespace fish::java::java {
         public:
         ProgramBuilder(Program& program, const ClassFile& cls) :
         m_program(program), m_cls(cls) {
-            const auto& methods = cls.methods;
-            for (const MethodInfo& minfo : methods) {
-                const auto& descriptor = minfo.descriptor(cpool());
-                Function& func = *m_program.functions().add(Function(
-                    descriptor.nargs(), descriptor.nreturn(),
-                    minfo.name(cpool())
-                ));
-                m_funcs.emplace(minfo.name_and_type(), &func);
-            }
         }
 
+        // Builds every method in the class.
         void build();
 
+        // Builds `minfo` and every method it can call.
+        void build(const MethodInfo& minfo);
+
+        // Builds a function that runs `minfo` from the instruction at
+        // `offset`, where the operand stack must be empty, along with
+        // every method it can call. Its arguments are the values of the
+        // method's local variables.
+        Function& build_osr(const MethodInfo& minfo, std::size_t offset);
+
+        // Returns the function for `minfo`, adding it to the program (to
+        // be built by the next call to build()) if needed.
+        Function& function(const MethodInfo& minfo) {
+            auto it = m_funcs.find(&minfo);
+            if (it != m_funcs.end()) {
+                return *it->second;
+            }
+            const auto& descriptor = minfo.descriptor(cpool());
+            Function& func = *m_program.functions().add(Function(
+                descriptor.nargs(), descriptor.nreturn(), minfo.name(cpool())
+            ));
+            m_funcs.emplace(&minfo, &func);
+            m_pending.push_back(&minfo);
+            return func;
+        }
+
+        const auto& functions() const {
+            return m_funcs;
+        }
+
         protected:
         friend class FunctionBuilder;
 
         Function& find_function(const pool::NameAndType& id) {
-            auto it = m_funcs.find(id);
-            assert(it != m_funcs.end());
-            return *it->second;
+            const MethodInfo* minfo = cls().methods.find(id);
+            assert(minfo);
+            return function(*minfo);
         }
 
         const ClassFile& cls() const {
@@ -69,11 +90,14 @@ namespace fish::java::java {
         private:
         Program& m_program;
         const ClassFile& m_cls;
-        std::map<pool::NameAndType, Function*> m_funcs;
+        std::unordered_map<const MethodInfo*, Function*> m_funcs;
+        std::vector<const MethodInfo*> m_pending;
 
         const ConstantPool& cpool() const {
             return cls().cpool;
         }
+
+        void build_pending();
     };
 
     class FunctionBuilder {
@@ -110,9 +134,10 @@ namespace fish::java::java {
 
         public:
         FunctionBuilder(
-            ProgramBuilder& parent, Function& func, const MethodInfo& minfo
+            ProgramBuilder& parent, Function& func, const MethodInfo& minfo,
+            std::size_t start = 0
         ) :
-        m_parent(parent), m_function(func), m_minfo(minfo) {
+        m_parent(parent), m_function(func), m_minfo(minfo), m_start(start) {
         }
 
         void build();
@@ -149,6 +174,9 @@ namespace fish::java::java {
         Function& m_function;
         const MethodInfo& m_minfo;
 
+        // Bytecode offset where the function begins.
+        std::size_t m_start = 0;
+
         std::unordered_map<const u8*, InstructionIterator> m_inst_map;
         std::list<InstRef> m_unlinked;
         std::vector<const u8*> m_sources;
@@ -175,10 +203,39 @@ namespace fish::java::java {
     };
 
     inline void ProgramBuilder::build() {
-        const auto& methods = cls().methods;
-        for (const MethodInfo& minfo : methods) {
-            Function& func = find_function(minfo.name_and_type());
-            FunctionBuilder builder(*this, func, minfo);
+        for (const MethodInfo& minfo : cls().methods) {
+            function(minfo);
+        }
+        build_pending();
+    }
+
+    inline void ProgramBuilder::build(const MethodInfo& minfo) {
+        function(minfo);
+        build_pending();
+    }
+
+    inline Function&
+    ProgramBuilder::build_osr(const MethodInfo& minfo, std::size_t offset) {
+        if (offset >= minfo.code.code.size()) {
+            throw std::runtime_error("Invalid OSR entry point");
+        }
+        const auto& descriptor = minfo.descriptor(cpool());
+        Function& func = *m_program.functions().add(Function(
+            minfo.code.max_locals, descriptor.nreturn(),
+            minfo.name(cpool()) + "$osr"
+        ));
+        FunctionBuilder builder(*this, func, minfo, offset);
+        builder.build();
+        build_pending();
+        return func;
+    }
+
+    inline void ProgramBuilder::build_pending() {
+        // Building a function can add the functions it calls.
+        while (!m_pending.empty()) {
+            const MethodInfo& minfo = *m_pending.back();
+            m_pending.pop_back();
+            FunctionBuilder builder(*this, *m_funcs.at(&minfo), minfo);
             builder.build();
         }
     }
@@ -258,7 +315,7 @@ namespace fish::java::java {
     };
 
     inline void FunctionBuilder::build() {
-        const u8* code = code_begin();
+        const u8* code = code_begin() + m_start;
         build_at_pos(code);
 
         while (!m_unlinked.empty()) {
@@ -581,7 +638,7 @@ namespace fish::java::java {
             call.args().emplace_front(pop());
         }
 
-        if (mdesc.nargs() > 0) {
+        if (mdesc.nreturn() > 0) {
             call.dest().emplace(push());
         }
         return 3;
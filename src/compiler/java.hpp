@@ -18,6 +18,7 @@
  */
 
 #pragma once
+#include "arena.hpp"
 #include "../typedefs.hpp"
 #include "../utils.hpp"
 #include <bitset>
@@ -36,7 +37,7 @@ namespace fish::java::java {
     class Instruction;
     class Function;
 
-    using InstructionList = std::list<Instruction>;
+    using InstructionList = ArenaList<Instruction>;
     using InstructionIterator = InstructionList::iterator;
     using ConstInstructionIterator = InstructionList::const_iterator;
 
@@ -153,7 +154,7 @@ namespace fish::java::java {
         shr,
     };
 
-    std::ostream&
+    inline std::ostream&
     operator<<(std::ostream& stream, ArithmeticOperator op) {
         switch (op) {
             case ArithmeticOperator::add: {
@@ -193,7 +194,7 @@ namespace fish::java::java {
         ge,
     };
 
-    std::ostream&
+    inline std::ostream&
     operator<<(std::ostream& stream, ComparisonOperator op) {
         switch (op) {
             case ComparisonOperator::eq: {
@@ -228,6 +229,60 @@ namespace fish::java::java {
         return stream;
     }
 
+    // The operator that gives the same result when the operands are swapped.
+    inline ComparisonOperator swapped(ComparisonOperator op) {
+        switch (op) {
+            case ComparisonOperator::eq: {
+                return ComparisonOperator::eq;
+            }
+            case ComparisonOperator::ne: {
+                return ComparisonOperator::ne;
+            }
+            case ComparisonOperator::lt: {
+                return ComparisonOperator::gt;
+            }
+            case ComparisonOperator::le: {
+                return ComparisonOperator::ge;
+            }
+            case ComparisonOperator::gt: {
+                return ComparisonOperator::lt;
+            }
+            case ComparisonOperator::ge: {
+                return ComparisonOperator::le;
+            }
+            default: {
+                return op;
+            }
+        }
+    }
+
+    // The operator that gives the opposite result.
+    inline ComparisonOperator negated(ComparisonOperator op) {
+        switch (op) {
+            case ComparisonOperator::eq: {
+                return ComparisonOperator::ne;
+            }
+            case ComparisonOperator::ne: {
+                return ComparisonOperator::eq;
+            }
+            case ComparisonOperator::lt: {
+                return ComparisonOperator::ge;
+            }
+            case ComparisonOperator::le: {
+                return ComparisonOperator::gt;
+            }
+            case ComparisonOperator::gt: {
+                return ComparisonOperator::le;
+            }
+            case ComparisonOperator::ge: {
+                return ComparisonOperator::lt;
+            }
+            default: {
+                return op;
+            }
+        }
+    }
+
     class Move {
         public:
         template <typename Source>
@@ -452,7 +507,7 @@ namespace fish::java::java {
 
     class BaseFunctionCall {
         protected:
-        using ArgList = std::list<Value>;
+        using ArgList = ArenaList<Value>;
 
         template <typename... Args>
         BaseFunctionCall(Args&&... args) :
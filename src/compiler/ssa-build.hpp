@@ -52,9 +52,6 @@ namespace fish::java::ssa {
 
         void build();
 
-        protected:
-        friend class FunctionBuilder;
-
         Function& function(const java::Function& j_func) {
             auto it = m_func_map.find(&j_func);
             assert(it != m_func_map.end());
@@ -174,7 +171,7 @@ namespace fish::java::ssa {
             return m_block.terminate(std::forward<T>(term));
         }
 
-        void bind(Value& dest, const java::Value& source) {
+        void bind(Use& dest, const java::Value& source) {
             source.visit([&] (auto& obj) {
                 using T = std::decay_t<decltype(obj)>;
 
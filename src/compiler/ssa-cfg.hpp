@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa.hpp"
+#include "../typedefs.hpp"
+#include <iterator>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Removes the extra blocks and jumps left by the builders and by
+     * other passes. Branches on constants are folded, branches are
+     * forwarded through empty blocks and threaded through blocks whose
+     * condition is known from the predecessor, blocks are merged with
+     * their only successor, and unreachable blocks are removed. These
+     * are repeated until nothing changes.
+     *
+     * The x64 builder assigns the phis of every successor at the end of
+     * a block, before it branches. The SSA builder already makes edges
+     * from blocks with several successors to blocks with phis, and the
+     * register allocators keep those phis out of the registers of values
+     * live along the other edges. This pass adds no such edges, as a phi
+     * could itself be live along another edge of the predecessor.
+     */
+    class CfgSimplifier {
+        public:
+        CfgSimplifier(Function& func) : m_func(func) {
+        }
+
+        // Returns whether anything changed.
+        bool run() {
+            decltype(auto) blocks = m_func.blocks();
+            if (blocks.begin() == blocks.end()) {
+                return false;
+            }
+
+            bool changed = false;
+            bool progress = true;
+            while (progress) {
+                progress = remove_trivial_phis();
+                progress |= fold_branches();
+                progress |= thread_jumps();
+                progress |= forward_empty_blocks();
+                progress |= remove_unreachable();
+                progress |= merge_blocks();
+                changed |= progress;
+            }
+            return changed;
+        }
+
+        private:
+        Function& m_func;
+
+        BasicBlock& entry() {
+            return *m_func.blocks().begin();
+        }
+
+        // Replaces phis whose inputs are all the same (apart from the phi
+        // itself) with that input.
+        bool remove_trivial_phis() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                decltype(auto) instructions = block.instructions();
+                auto it = instructions.begin();
+                while (it != instructions.end()) {
+                    auto phi = it->get_if<Phi>();
+                    if (!phi) {
+                        break;
+                    }
+                    std::optional<Value> input = unique_input(it);
+                    if (!input) {
+                        ++it;
+                        continue;
+                    }
+                    it->replace_all_uses_with(*input);
+                    it = instructions.erase(it);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        static std::optional<Value> unique_input(InstructionIterator phi) {
+            std::optional<Value> result;
+            for (PhiPair& pair : phi->get<Phi>()) {
+                const Value& value = pair.value();
+                auto inst = value.get_if<InstructionIterator>();
+                if (inst && *inst == phi) {
+                    continue;
+                }
+                if (result && !same(*result, value)) {
+                    return std::nullopt;
+                }
+                result = value;
+            }
+            return result;
+        }
+
+        static bool same(const Value& a, const Value& b) {
+            auto inst_a = a.get_if<InstructionIterator>();
+            auto inst_b = b.get_if<InstructionIterator>();
+            if (inst_a || inst_b) {
+                return inst_a && inst_b && *inst_a == *inst_b;
+            }
+            auto const_a = a.get_if<Constant>();
+            auto const_b = b.get_if<Constant>();
+            return const_a && const_b && const_a->value() == const_b->value();
+        }
+
+        // Turns branches on constants, and branches whose targets are the
+        // same, into unconditional branches.
+        bool fold_branches() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                auto branch = block.terminator().get_if<Branch>();
+                if (!branch) continue;
+                if (&branch->yes() == &branch->no()) {
+                    fold_same_targets(block, *branch);
+                    changed = true;
+                    continue;
+                }
+                auto cond = branch->cond().get_if<Constant>();
+                if (!cond) continue;
+                BasicBlock& yes = branch->yes();
+                BasicBlock& no = branch->no();
+                const bool take_yes = cond->value() != 0;
+                remove_phi_inputs(take_yes ? no : yes, block);
+                block.terminate(UnconditionalBranch(take_yes ? yes : no));
+                changed = true;
+            }
+            return changed;
+        }
+
+        // The condition is removed too if nothing else uses it, as this
+        // pass is also the last one run.
+        static void fold_same_targets(BasicBlock& block, Branch& branch) {
+            BasicBlock& target = branch.yes();
+            auto cond = branch.cond().get_if<InstructionIterator>();
+            std::optional<InstructionIterator> inst;
+            if (cond) {
+                inst = *cond;
+            }
+
+            block.terminate(UnconditionalBranch(target));
+            if (inst && (*inst)->uses().empty()) {
+                if (!(*inst)->has_side_effect()) {
+                    (*inst)->block().instructions().erase(*inst);
+                }
+            }
+        }
+
+        // Makes predecessors of a block that only decides a branch from
+        // a phi jump straight to the target, when their input to the phi
+        // is a constant. This undoes the `x = a < b ? 1 : 0; if (x != 0)`
+        // pattern javac emits for boolean expressions.
+        bool thread_jumps() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                if (&block == &entry()) continue;
+                auto branch = block.terminator().get_if<Branch>();
+                if (!branch) continue;
+
+                decltype(auto) instructions = block.instructions();
+                auto phi = instructions.begin();
+                if (phi == instructions.end()) continue;
+                if (!phi->get_if<Phi>() || phi->uses().size() != 1) {
+                    continue;
+                }
+
+                // The branch is on the phi or on a comparison of the phi
+                // with a constant.
+                auto cond = branch->cond().get_if<InstructionIterator>();
+                if (!cond) continue;
+                auto next = std::next(phi);
+                const Comparison* cmp = nullptr;
+                if (*cond == phi) {
+                    if (next != instructions.end()) continue;
+                }
+                else {
+                    if (*cond != next) continue;
+                    if (std::next(next) != instructions.end()) continue;
+                    cmp = next->get_if<Comparison>();
+                    if (!cmp || next->uses().size() != 1) continue;
+                    if (!compares(*cmp, phi)) continue;
+                }
+
+                std::vector<std::pair<BasicBlock*, BasicBlock*>> threads;
+                for (PhiPair& pair : phi->get<Phi>()) {
+                    const Value& value = pair.value();
+                    auto constant = value.get_if<Constant>();
+                    if (!constant) continue;
+                    bool taken = constant->value() != 0;
+                    if (cmp) {
+                        taken = evaluate(*cmp, phi, *constant);
+                    }
+                    BasicBlock& pred = pair.block();
+                    BasicBlock& target = taken ? branch->yes() : branch->no();
+                    if (&target != &block && can_retarget(pred, target)) {
+                        threads.emplace_back(&pred, &target);
+                    }
+                }
+
+                for (auto [pred, target] : threads) {
+                    add_phi_inputs(*target, block, *pred);
+                    remove_phi_inputs(block, *pred);
+                    pred->retarget(block, *target);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        static bool compares(const Comparison& cmp, InstructionIterator phi) {
+            auto left = cmp.left().get_if<InstructionIterator>();
+            auto right = cmp.right().get_if<InstructionIterator>();
+            if (left && *left == phi) {
+                return cmp.right().get_if<Constant>() != nullptr;
+            }
+            if (right && *right == phi) {
+                return cmp.left().get_if<Constant>() != nullptr;
+            }
+            return false;
+        }
+
+        // Evaluates `cmp` with `value` in place of `phi`.
+        static bool evaluate(
+            const Comparison& cmp, InstructionIterator phi, Constant value
+        ) {
+            auto operand = [&] (const Value& v) {
+                auto inst = v.get_if<InstructionIterator>();
+                u64 result = inst && *inst == phi ? (
+                    value.value()
+                ) : v.get<Constant>().value();
+                return static_cast<s32>(result);
+            };
+
+            const s32 a = operand(cmp.left());
+            const s32 b = operand(cmp.right());
+            switch (cmp.op()) {
+                case Comparison::Op::eq: {
+                    return a == b;
+                }
+                case Comparison::Op::ne: {
+                    return a != b;
+                }
+                case Comparison::Op::lt: {
+                    return a < b;
+                }
+                case Comparison::Op::le: {
+                    return a <= b;
+                }
+                case Comparison::Op::gt: {
+                    return a > b;
+                }
+                case Comparison::Op::ge: {
+                    return a >= b;
+                }
+            }
+            return false;
+        }
+
+        // Makes predecessors of empty blocks that only jump somewhere
+        // else jump there directly.
+        bool forward_empty_blocks() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                if (&block == &entry()) continue;
+                decltype(auto) instructions = block.instructions();
+                if (instructions.begin() != instructions.end()) continue;
+                auto jump = block.terminator().get_if<UnconditionalBranch>();
+                if (!jump || &jump->target() == &block) continue;
+                BasicBlock& target = jump->target();
+
+                std::vector<BasicBlock*> preds(
+                    block.predecessors().begin(), block.predecessors().end()
+                );
+                for (BasicBlock* pred : preds) {
+                    if (!can_retarget(*pred, target)) continue;
+                    add_phi_inputs(target, block, *pred);
+                    pred->retarget(block, target);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        // Whether `pred` can branch to `target` instead of one of its
+        // current successors.
+        static bool can_retarget(BasicBlock& pred, BasicBlock& target) {
+            if (pred.successors().count(&target) > 0) {
+                return false;
+            }
+            if (pred.successors().size() == 1) {
+                return true;
+            }
+            decltype(auto) instructions = target.instructions();
+            auto first = instructions.begin();
+            return first == instructions.end() || !first->get_if<Phi>();
+        }
+
+        bool remove_unreachable() {
+            std::unordered_set<const BasicBlock*> reachable = {&entry()};
+            std::vector<BasicBlock*> stack = {&entry()};
+            while (!stack.empty()) {
+                BasicBlock* block = stack.back();
+                stack.pop_back();
+                for (BasicBlock* succ : block->successors()) {
+                    if (reachable.insert(succ).second) {
+                        stack.push_back(succ);
+                    }
+                }
+            }
+
+            std::vector<Function::BlockIterator> remove;
+            auto it = m_func.blocks().begin();
+            auto end = m_func.blocks().end();
+            for (; it != end; ++it) {
+                if (reachable.count(&*it) > 0) continue;
+                for (BasicBlock* succ : it->successors()) {
+                    if (reachable.count(succ) > 0) {
+                        remove_phi_inputs(*succ, *it);
+                    }
+                }
+                remove.push_back(it);
+            }
+            for (auto block : remove) {
+                m_func.blocks().erase(block);
+            }
+            return !remove.empty();
+        }
+
+        // Appends blocks to their predecessor when it is their only one
+        // and they are its only successor.
+        bool merge_blocks() {
+            std::unordered_map<const BasicBlock*, Function::BlockIterator>
+            iters;
+            auto it = m_func.blocks().begin();
+            auto end = m_func.blocks().end();
+            for (; it != end; ++it) {
+                iters.emplace(&*it, it);
+            }
+
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                while (BasicBlock* succ = mergeable(block)) {
+                    decltype(auto) instructions = succ->instructions();
+                    auto phi = instructions.begin();
+                    while (phi != instructions.end() && phi->get_if<Phi>()) {
+                        const Value& value = phi->get<Phi>().begin()->value();
+                        phi->replace_all_uses_with(value);
+                        phi = instructions.erase(phi);
+                    }
+                    block.instructions().splice(
+                        block.instructions().end(), *succ,
+                        instructions.begin(), instructions.end()
+                    );
+                    succ->move_terminator(block);
+                    m_func.blocks().erase(iters.at(succ));
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        BasicBlock* mergeable(BasicBlock& block) {
+            auto jump = block.terminator().get_if<UnconditionalBranch>();
+            if (!jump) {
+                return nullptr;
+            }
+            BasicBlock& succ = jump->target();
+            if (&succ == &block || &succ == &entry()) {
+                return nullptr;
+            }
+            if (succ.predecessors().size() != 1) {
+                return nullptr;
+            }
+
+            // A phi in a block with one predecessor can only refer to
+            // itself in unreachable code.
+            for (Instruction& inst : succ.instructions()) {
+                auto phi = inst.get_if<Phi>();
+                if (!phi) break;
+                const Value& value = phi->begin()->value();
+                auto ptr = value.get_if<InstructionIterator>();
+                if (ptr && &**ptr == &inst) {
+                    return nullptr;
+                }
+            }
+            return &succ;
+        }
+
+        // Gives `block`'s phis the same input from `pred` as from `from`.
+        static void add_phi_inputs(
+            BasicBlock& block, BasicBlock& from, BasicBlock& pred
+        ) {
+            for (auto& [phi, input] : block.phis(from)) {
+                const Value& value = *input;
+                phi->get<Phi>().emplace(pred, value);
+            }
+        }
+
+        static void remove_phi_inputs(BasicBlock& block, BasicBlock& pred) {
+            for (Instruction& inst : block.instructions()) {
+                auto phi = inst.get_if<Phi>();
+                if (!phi) break;
+                auto it = phi->begin();
+                auto end = phi->end();
+                for (; it != end; ++it) {
+                    if (&it->block() == &pred) {
+                        phi->erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+    };
+
+    inline bool simplify_cfg(Function& function) {
+        return CfgSimplifier(function).run();
+    }
+}
@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa.hpp"
+#include "../typedefs.hpp"
+#include "../utils.hpp"
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Sparse conditional constant propagation, by Wegman and Zadeck
+     * ("Constant Propagation with Conditional Branches"). Values are
+     * assumed constant until shown otherwise, and blocks unreachable
+     * until an executable edge leads to them, so constants are found
+     * through phis and loops that depend on constant branches.
+     *
+     * Arithmetic follows Java's 32-bit semantics: results wrap around,
+     * and shift amounts use only their low 5 bits.
+     */
+    class ConstantPropagator {
+        public:
+        ConstantPropagator(Function& func) : m_func(func) {
+        }
+
+        // Returns whether the function changed.
+        bool run() {
+            find_users();
+            solve();
+            bool changed = replace_constants();
+            changed |= fold_branches();
+            changed |= remove_unreachable();
+            changed |= remove_trivial_phis();
+            return changed;
+        }
+
+        private:
+        struct Lattice {
+            enum class Kind {
+                // Not known yet; may still turn out to be constant.
+                unknown,
+                constant,
+                varying,
+            };
+
+            Kind kind = Kind::unknown;
+            u32 value = 0;
+
+            bool operator==(const Lattice& other) const {
+                return kind == other.kind && (
+                    kind != Kind::constant || value == other.value
+                );
+            }
+
+            bool operator!=(const Lattice& other) const {
+                return !(*this == other);
+            }
+        };
+
+        // The instruction or terminator (if `inst` is null) that has a
+        // given operand.
+        struct User {
+            BasicBlock* block = nullptr;
+            Instruction* inst = nullptr;
+        };
+
+        using Edge = std::pair<const BasicBlock*, const BasicBlock*>;
+
+        Function& m_func;
+        std::unordered_map<const Use*, User> m_users;
+        std::unordered_map<const Instruction*, Lattice> m_values;
+        std::set<const BasicBlock*> m_reachable;
+        std::set<Edge> m_edges;
+        std::vector<std::pair<BasicBlock*, BasicBlock*>> m_flow_work;
+        std::vector<User> m_ssa_work;
+
+        static Lattice constant(u32 value) {
+            return Lattice{Lattice::Kind::constant, value};
+        }
+
+        static Lattice varying() {
+            return Lattice{Lattice::Kind::varying, 0};
+        }
+
+        // Constants are stored sign-extended to 64 bits.
+        static Constant to_constant(u32 value) {
+            return Constant(static_cast<u64>(static_cast<s32>(value)));
+        }
+
+        void find_users() {
+            for (BasicBlock& block : m_func.blocks()) {
+                for (Instruction& inst : block.instructions()) {
+                    for (Use* use : inst.inputs()) {
+                        m_users.emplace(use, User{&block, &inst});
+                    }
+                }
+                for (Use* use : block.terminator().inputs()) {
+                    m_users.emplace(use, User{&block, nullptr});
+                }
+            }
+        }
+
+        Lattice value(const Value& value) const {
+            return value.visit([&] (auto& obj) {
+                using T = std::decay_t<decltype(obj)>;
+                if constexpr (std::is_same_v<T, Constant>) {
+                    return constant(static_cast<u32>(obj.value()));
+                }
+                else if constexpr (std::is_same_v<T, InstructionIterator>) {
+                    auto it = m_values.find(&*obj);
+                    return it == m_values.end() ? Lattice() : it->second;
+                }
+                else {
+                    return varying();
+                }
+            });
+        }
+
+        bool reachable(const BasicBlock& from, const BasicBlock& to) const {
+            return m_edges.count(Edge(&from, &to)) > 0;
+        }
+
+        void solve() {
+            m_flow_work.emplace_back(nullptr, &*m_func.blocks().begin());
+            while (true) {
+                while (!m_flow_work.empty() || !m_ssa_work.empty()) {
+                    if (!m_flow_work.empty()) {
+                        auto [from, to] = m_flow_work.back();
+                        m_flow_work.pop_back();
+                        visit_edge(from, *to);
+                        continue;
+                    }
+                    User user = m_ssa_work.back();
+                    m_ssa_work.pop_back();
+                    if (user.inst) {
+                        visit(*user.inst);
+                    } else {
+                        visit_terminator(*user.block);
+                    }
+                }
+                if (!resolve_unknown_branches()) {
+                    break;
+                }
+            }
+        }
+
+        // A branch on a value that never became known (e.g., one computed
+        // only from values that are never defined) is treated as if both
+        // of its targets could be taken.
+        bool resolve_unknown_branches() {
+            bool found = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                if (m_reachable.count(&block) == 0) continue;
+                auto branch = block.terminator().get_if<Branch>();
+                if (!branch) continue;
+                if (value(branch->cond()).kind != Lattice::Kind::unknown) {
+                    continue;
+                }
+                for (BasicBlock* succ : branch->successors()) {
+                    if (!reachable(block, *succ)) {
+                        m_flow_work.emplace_back(&block, succ);
+                        found = true;
+                    }
+                }
+            }
+            return found;
+        }
+
+        void visit_edge(BasicBlock* from, BasicBlock& to) {
+            if (from && !m_edges.emplace(from, &to).second) {
+                return;
+            }
+
+            // Only the phis depend on which edges are executable.
+            if (!m_reachable.insert(&to).second) {
+                for (Instruction& inst : to.instructions()) {
+                    if (!inst.get_if<Phi>()) break;
+                    visit(inst);
+                }
+                return;
+            }
+            for (Instruction& inst : to.instructions()) {
+                visit(inst);
+            }
+            visit_terminator(to);
+        }
+
+        void visit(Instruction& inst) {
+            if (m_reachable.count(&inst.block()) == 0) {
+                return;
+            }
+            Lattice& current = m_values[&inst];
+            if (current.kind == Lattice::Kind::varying) {
+                return;
+            }
+            const Lattice next = evaluate(inst);
+            if (next == current) {
+                return;
+            }
+            current = next;
+            for (Use& use : inst.uses()) {
+                m_ssa_work.push_back(m_users.at(&use));
+            }
+        }
+
+        void visit_terminator(BasicBlock& block) {
+            block.terminator().visit([&] (auto& obj) {
+                using T = std::decay_t<decltype(obj)>;
+                if constexpr (std::is_same_v<T, UnconditionalBranch>) {
+                    m_flow_work.emplace_back(&block, &obj.target());
+                }
+                else if constexpr (std::is_same_v<T, Branch>) {
+                    const Lattice cond = value(obj.cond());
+                    if (cond.kind == Lattice::Kind::unknown) {
+                        return;
+                    }
+                    if (cond.kind == Lattice::Kind::varying || cond.value) {
+                        m_flow_work.emplace_back(&block, &obj.yes());
+                    }
+                    if (cond.kind == Lattice::Kind::varying || !cond.value) {
+                        m_flow_work.emplace_back(&block, &obj.no());
+                    }
+                }
+            });
+        }
+
+        Lattice evaluate(Instruction& inst) const {
+            return inst.visit([&] (auto& obj) -> Lattice {
+                using T = std::decay_t<decltype(obj)>;
+                if constexpr (std::is_same_v<T, Move>) {
+                    return value(obj.value());
+                }
+                else if constexpr (std::is_same_v<T, BinaryOperation>) {
+                    return evaluate(obj);
+                }
+                else if constexpr (std::is_same_v<T, Comparison>) {
+                    return evaluate(obj);
+                }
+                else if constexpr (std::is_same_v<T, Phi>) {
+                    return evaluate(obj, inst.block());
+                }
+                else {
+                    // Calls, loads, and arguments aren't known.
+                    return varying();
+                }
+            });
+        }
+
+        Lattice evaluate(const BinaryOperation& inst) const {
+            const Lattice left = value(inst.left());
+            const Lattice right = value(inst.right());
+            if (left.kind != Lattice::Kind::constant ||
+                right.kind != Lattice::Kind::constant) {
+                return meet(left, right);
+            }
+
+            const u32 a = left.value;
+            const u32 b = right.value;
+            switch (inst.op()) {
+                case BinaryOperation::Op::add: {
+                    return constant(a + b);
+                }
+                case BinaryOperation::Op::sub: {
+                    return constant(a - b);
+                }
+                case BinaryOperation::Op::mul: {
+                    return constant(a * b);
+                }
+                case BinaryOperation::Op::shl: {
+                    return constant(a << (b & 0b11111));
+                }
+                case BinaryOperation::Op::shr: {
+                    const u32 amount = b & 0b11111;
+                    u32 result = a >> amount;
+                    if (amount > 0 && (a & (u32(1) << (32 - 1)))) {
+                        result |= ~u32(0) << (32 - amount);
+                    }
+                    return constant(result);
+                }
+            }
+            return varying();
+        }
+
+        Lattice evaluate(const Comparison& inst) const {
+            const Lattice left = value(inst.left());
+            const Lattice right = value(inst.right());
+            if (left.kind != Lattice::Kind::constant ||
+                right.kind != Lattice::Kind::constant) {
+                return meet(left, right);
+            }
+
+            const s32 a = static_cast<s32>(left.value);
+            const s32 b = static_cast<s32>(right.value);
+            switch (inst.op()) {
+                case Comparison::Op::eq: {
+                    return constant(a == b);
+                }
+                case Comparison::Op::ne: {
+                    return constant(a != b);
+                }
+                case Comparison::Op::lt: {
+                    return constant(a < b);
+                }
+                case Comparison::Op::le: {
+                    return constant(a <= b);
+                }
+                case Comparison::Op::gt: {
+                    return constant(a > b);
+                }
+                case Comparison::Op::ge: {
+                    return constant(a >= b);
+                }
+            }
+            return varying();
+        }
+
+        // Inputs from edges that can't be taken are ignored.
+        Lattice evaluate(const Phi& phi, const BasicBlock& block) const {
+            Lattice result;
+            for (const PhiPair& pair : phi) {
+                if (!reachable(pair.block(), block)) continue;
+                const Lattice input = value(pair.value());
+                if (result.kind == Lattice::Kind::unknown) {
+                    result = input;
+                } else if (input.kind != Lattice::Kind::unknown) {
+                    result = result == input ? result : varying();
+                }
+            }
+            return result;
+        }
+
+        // The result of an operation whose operands aren't both constant:
+        // varying if either operand is, and unknown otherwise.
+        static Lattice meet(const Lattice& left, const Lattice& right) {
+            if (left.kind == Lattice::Kind::varying ||
+                right.kind == Lattice::Kind::varying) {
+                return varying();
+            }
+            return Lattice();
+        }
+
+        bool replace_constants() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                if (m_reachable.count(&block) == 0) continue;
+                for (Instruction& inst : block.instructions()) {
+                    if (inst.has_side_effect() || inst.uses().empty()) {
+                        continue;
+                    }
+                    auto it = m_values.find(&inst);
+                    if (it == m_values.end()) continue;
+                    const Lattice& lattice = it->second;
+                    if (lattice.kind != Lattice::Kind::constant) continue;
+                    inst.replace_all_uses_with(
+                        Value(to_constant(lattice.value))
+                    );
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        // Turns branches that can go only one way into unconditional
+        // branches.
+        bool fold_branches() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                if (m_reachable.count(&block) == 0) continue;
+                auto branch = block.terminator().get_if<Branch>();
+                if (!branch) continue;
+                BasicBlock& yes = branch->yes();
+                BasicBlock& no = branch->no();
+                const bool take_yes = reachable(block, yes);
+                const bool take_no = reachable(block, no);
+                if (take_yes == take_no) continue;
+
+                remove_phi_inputs(take_yes ? no : yes, block);
+                block.terminate(UnconditionalBranch(take_yes ? yes : no));
+                changed = true;
+            }
+            return changed;
+        }
+
+        bool remove_unreachable() {
+            std::vector<Function::BlockIterator> remove;
+            auto it = m_func.blocks().begin();
+            auto end = m_func.blocks().end();
+            for (; it != end; ++it) {
+                if (m_reachable.count(&*it) > 0) continue;
+                for (BasicBlock* succ : it->successors()) {
+                    if (m_reachable.count(succ) > 0) {
+                        remove_phi_inputs(*succ, *it);
+                    }
+                }
+                remove.push_back(it);
+            }
+            for (auto block : remove) {
+                m_func.blocks().erase(block);
+            }
+            return !remove.empty();
+        }
+
+        // Replaces phis with one input with that input.
+        bool remove_trivial_phis() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                auto it = block.instructions().begin();
+                auto end = block.instructions().end();
+                for (; it != end; ++it) {
+                    auto phi = it->get_if<Phi>();
+                    if (!phi) break;
+                    if (phi->size() != 1 || it->uses().empty()) continue;
+                    const Value input = phi->begin()->value();
+                    auto ptr = input.get_if<InstructionIterator>();
+                    if (ptr && *ptr == it) continue;
+                    it->replace_all_uses_with(input);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        static void remove_phi_inputs(BasicBlock& block, BasicBlock& pred) {
+            for (Instruction& inst : block.instructions()) {
+                auto phi = inst.get_if<Phi>();
+                if (!phi) break;
+                auto it = phi->begin();
+                auto end = phi->end();
+                for (; it != end; ++it) {
+                    if (&it->block() == &pred) {
+                        phi->erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+    };
+
+    inline bool propagate_constants(Function& function) {
+        return ConstantPropagator(function).run();
+    }
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "dominators.hpp"
+#include "ssa.hpp"
+#include "../typedefs.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Dominator-based global value numbering. The dominator tree is
+     * walked in preorder with a scoped table of the expressions computed
+     * by dominating blocks; an operation that matches one of them is
+     * replaced by it.
+     *
+     * Since every operand refers directly to the instruction that
+     * computes it (copies having been propagated), an instruction serves
+     * as its own value number.
+     */
+    class ValueNumbering {
+        public:
+        ValueNumbering(Function& func) : m_func(func), m_doms(func) {
+        }
+
+        // Returns whether any instruction was removed.
+        bool run() {
+            decltype(auto) blocks = m_func.blocks();
+            if (blocks.begin() == blocks.end()) {
+                return false;
+            }
+
+            bool changed = false;
+            std::vector<std::pair<BasicBlock*, std::size_t>> stack;
+            std::vector<std::size_t> scopes;
+            std::vector<Key> added;
+
+            auto enter = [&] (BasicBlock& block) {
+                stack.emplace_back(&block, 0);
+                scopes.push_back(added.size());
+                changed |= number(block, added);
+            };
+
+            enter(*blocks.begin());
+            while (!stack.empty()) {
+                auto& [block, index] = stack.back();
+                auto& children = m_doms.children(*block);
+                if (index < children.size()) {
+                    enter(const_cast<BasicBlock&>(*children[index++]));
+                    continue;
+                }
+
+                // Expressions in this block don't dominate its siblings.
+                for (std::size_t i = scopes.back(); i < added.size(); ++i) {
+                    m_table.erase(added[i]);
+                }
+                added.resize(scopes.back());
+                scopes.pop_back();
+                stack.pop_back();
+            }
+            return changed;
+        }
+
+        private:
+        // A constant or the instruction that computes a value.
+        using Operand = std::pair<bool, std::uintptr_t>;
+
+        // The kind of instruction, its operator, and its operands.
+        using Key = std::tuple<std::size_t, int, Operand, Operand>;
+
+        Function& m_func;
+        Dominators m_doms;
+        std::map<Key, InstructionIterator> m_table;
+
+        bool number(BasicBlock& block, std::vector<Key>& added) {
+            bool changed = false;
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            while (it != instructions.end()) {
+                std::optional<Key> key = this->key(*it);
+                if (!key) {
+                    ++it;
+                    continue;
+                }
+
+                auto [entry, inserted] = m_table.emplace(*key, it);
+                if (inserted) {
+                    added.push_back(*key);
+                    ++it;
+                    continue;
+                }
+                if (fusable(block, *it)) {
+                    ++it;
+                    continue;
+                }
+                it->replace_all_uses_with(Value(entry->second));
+                it = instructions.erase(it);
+                changed = true;
+            }
+            return changed;
+        }
+
+        // A comparison used only by the branch right after it is fused
+        // with the branch by the x64 builder, which is cheaper than
+        // keeping an earlier result in a register.
+        static bool fusable(BasicBlock& block, const Instruction& inst) {
+            if (!inst.get_if<Comparison>() || inst.uses().size() != 1) {
+                return false;
+            }
+            auto branch = block.terminator().get_if<Branch>();
+            if (!branch) {
+                return false;
+            }
+            auto cond = branch->cond().get_if<InstructionIterator>();
+            return cond && &**cond == &inst;
+        }
+
+        static Operand operand(const Value& value) {
+            if (auto inst = value.get_if<InstructionIterator>()) {
+                return Operand(
+                    false, reinterpret_cast<std::uintptr_t>(&**inst)
+                );
+            }
+            if (auto constant = value.get_if<Constant>()) {
+                return Operand(true, constant->value());
+            }
+            return Operand(false, 0);
+        }
+
+        // Operations that compute the same value have the same key.
+        // Operands of commutative operations are put in a fixed order,
+        // and `a > b` is treated as `b < a`.
+        static std::optional<Key> key(const Instruction& inst) {
+            if (auto op = inst.get_if<BinaryOperation>()) {
+                Operand left = operand(op->left());
+                Operand right = operand(op->right());
+                switch (op->op()) {
+                    case BinaryOperation::Op::add:
+                    case BinaryOperation::Op::mul: {
+                        if (right < left) {
+                            std::swap(left, right);
+                        }
+                        break;
+                    }
+                    default:;
+                }
+                return Key(0, static_cast<int>(op->op()), left, right);
+            }
+
+            if (auto cmp = inst.get_if<Comparison>()) {
+                Operand left = operand(cmp->left());
+                Operand right = operand(cmp->right());
+                Comparison::Op op = cmp->op();
+                switch (op) {
+                    case Comparison::Op::eq:
+                    case Comparison::Op::ne: {
+                        if (right < left) {
+                            std::swap(left, right);
+                        }
+                        break;
+                    }
+                    case Comparison::Op::gt: {
+                        std::swap(left, right);
+                        op = Comparison::Op::lt;
+                        break;
+                    }
+                    case Comparison::Op::ge: {
+                        std::swap(left, right);
+                        op = Comparison::Op::le;
+                        break;
+                    }
+                    default:;
+                }
+                return Key(1, static_cast<int>(op), left, right);
+            }
+            return std::nullopt;
+        }
+    };
+
+    inline bool number_values(Function& function) {
+        return ValueNumbering(function).run();
+    }
+}
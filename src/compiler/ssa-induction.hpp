@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa-loops.hpp"
+#include "ssa.hpp"
+#include "../typedefs.hpp"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Induction variable optimizations.
+     *
+     * A basic induction variable is a phi in a loop header that starts at
+     * some value and grows by a loop-invariant step on every iteration:
+     * `i = phi(a, i + s)`. A loop-invariant multiple of one, `i * k`, is
+     * a derived induction variable. It is given a phi of its own that
+     * starts at `a * k` and grows by `s * k`, which replaces the
+     * multiplication with an addition (strength reduction).
+     *
+     * The loop's exit test can then often be rewritten in terms of the
+     * new variable (linear-function test replacement). After that the
+     * original variable is used only to compute itself and is removed.
+     */
+    class InductionVariables {
+        using BlockSet = std::set<const BasicBlock*>;
+
+        public:
+        InductionVariables(Function& func) : m_func(func), m_loops(func) {
+        }
+
+        // Returns whether the function was changed.
+        bool run() {
+            bool changed = false;
+            for (BasicBlock& block : m_func.blocks()) {
+                auto it = m_loops.bodies().find(&block);
+                if (it != m_loops.bodies().end()) {
+                    changed |= optimize(block, it->second);
+                }
+            }
+            return changed;
+        }
+
+        private:
+        struct Basic {
+            InstructionIterator phi;
+            // Adds the step to `phi`; the phi's input from the latch.
+            InstructionIterator update;
+            BasicBlock* latch = nullptr;
+            Value init;
+            Value step;
+        };
+
+        using Derived = std::pair<InstructionIterator, Value>;
+
+        Function& m_func;
+        Loops m_loops;
+
+        bool optimize(BasicBlock& header, const BlockSet& body) {
+            const BasicBlock* pre = m_loops.preheader(header);
+            if (!pre) {
+                return false;
+            }
+
+            bool changed = false;
+            for (Basic& iv : find_basic(header, *pre, body)) {
+                auto derived = reduce(iv, *pre, body);
+                changed |= !derived.empty();
+                for (auto& [phi, factor] : derived) {
+                    if (replace_test(header, body, iv, phi, factor)) {
+                        changed = true;
+                        break;
+                    }
+                }
+                changed |= remove_if_dead(iv);
+            }
+            return changed;
+        }
+
+        std::vector<Basic> find_basic(
+            BasicBlock& header, const BasicBlock& pre, const BlockSet& body
+        ) {
+            std::vector<Basic> result;
+            decltype(auto) instructions = header.instructions();
+            for (auto it = instructions.begin(); it != instructions.end();) {
+                auto phi = it->get_if<Phi>();
+                if (!phi) {
+                    break;
+                }
+
+                auto inst = it++;
+                if (phi->size() != 2) {
+                    continue;
+                }
+                PhiPair* init = nullptr;
+                PhiPair* next = nullptr;
+                for (PhiPair& pair : *phi) {
+                    (&pair.block() == &pre ? init : next) = &pair;
+                }
+                if (!init || !next) {
+                    continue;
+                }
+
+                auto update = next->value().get_if<InstructionIterator>();
+                if (!update || body.count(&(*update)->block()) == 0) {
+                    continue;
+                }
+                auto op = (*update)->get_if<BinaryOperation>();
+                if (!op) {
+                    continue;
+                }
+                std::optional<Value> step = this->step(*op, inst, body);
+                if (!step) {
+                    continue;
+                }
+
+                const Value& init_value = init->value();
+                result.push_back(
+                    Basic{inst, *update, &next->block(), init_value, *step}
+                );
+            }
+            return result;
+        }
+
+        // Replaces every `iv * k` in the loop, where `k` is invariant,
+        // with a new induction variable. Returns the new phis along with
+        // their factors.
+        std::vector<Derived> reduce(
+            const Basic& iv, const BasicBlock& pre, const BlockSet& body
+        ) {
+            std::vector<Derived> result;
+            for (BasicBlock& block : m_func.blocks()) {
+                if (body.count(&block) == 0) {
+                    continue;
+                }
+
+                decltype(auto) instructions = block.instructions();
+                auto it = instructions.begin();
+                while (it != instructions.end()) {
+                    std::optional<Value> factor = this->factor(*it, iv, body);
+                    if (!factor) {
+                        ++it;
+                        continue;
+                    }
+                    auto phi = add_derived(iv, pre, *factor);
+                    it->replace_all_uses_with(Value(phi));
+                    it = instructions.erase(it);
+                    result.emplace_back(phi, *factor);
+                }
+            }
+            return result;
+        }
+
+        InstructionIterator add_derived(
+            const Basic& iv, const BasicBlock& pre, const Value& factor
+        ) {
+            BasicBlock& preheader = const_cast<BasicBlock&>(pre);
+            Value start = multiply(preheader, iv.init, factor);
+            Value step = multiply(preheader, iv.step, factor);
+
+            BasicBlock& header = iv.phi->block();
+            auto phi = header.instructions().insert(iv.phi, Phi());
+            auto next = iv.update->block().instructions().insert(
+                std::next(iv.update),
+                BinaryOperation(BinaryOperation::Op::add, Value(phi), step)
+            );
+            phi->get<Phi>().emplace(preheader, start);
+            phi->get<Phi>().emplace(*iv.latch, Value(next));
+            return phi;
+        }
+
+        // Computes `left * right` at the end of `block`. Constants are
+        // multiplied here; the generated code uses only their lower 32
+        // bits, so the product wraps like an int.
+        static Value multiply(
+            BasicBlock& block, const Value& left, const Value& right
+        ) {
+            auto left_const = left.get_if<Constant>();
+            auto right_const = right.get_if<Constant>();
+            if (left_const && right_const) {
+                return Value(
+                    Constant(left_const->value() * right_const->value())
+                );
+            }
+            if (right_const && right_const->value() == 0) {
+                return right;
+            }
+            if (left_const && left_const->value() == 0) {
+                return left;
+            }
+            if (right_const && right_const->value() == 1) {
+                return left;
+            }
+            if (left_const && left_const->value() == 1) {
+                return right;
+            }
+            return Value(block.instructions().append(
+                BinaryOperation(BinaryOperation::Op::mul, left, right)
+            ));
+        }
+
+        // Rewrites the loop's exit test `iv < n` as `iv * k < n * k`,
+        // using the derived variable `phi`, if that's known not to
+        // change the result. Only constant bounds are handled: it must
+        // be possible to show that neither side overflows.
+        bool replace_test(
+            BasicBlock& header, const BlockSet& body, const Basic& iv,
+            InstructionIterator phi, const Value& factor
+        ) {
+            auto branch = header.terminator().get_if<Branch>();
+            if (!branch) {
+                return false;
+            }
+            auto cond = branch->cond().get_if<InstructionIterator>();
+            if (!cond || &(*cond)->block() != &header) {
+                return false;
+            }
+            auto cmp = (*cond)->get_if<Comparison>();
+            if (!cmp) {
+                return false;
+            }
+            const bool stay_yes = body.count(&branch->yes()) > 0;
+            if (stay_yes == (body.count(&branch->no()) > 0)) {
+                return false;
+            }
+
+            // Put the test in the form `iv op bound`, which is true while
+            // the loop continues.
+            Comparison::Op op = cmp->op();
+            Use* var = &cmp->left();
+            Use* bound = &cmp->right();
+            if (refers_to(*bound, iv.phi)) {
+                std::swap(var, bound);
+                op = swapped(op);
+            }
+            if (!refers_to(*var, iv.phi)) {
+                return false;
+            }
+            if (!stay_yes) {
+                op = negated(op);
+            }
+
+            auto init = constant(iv.init);
+            auto step = constant(iv.step);
+            auto limit = constant(*bound);
+            auto k = constant(factor);
+            if (!init || !step || !limit || !k || *k == 0) {
+                return false;
+            }
+
+            // The range of values the variable has when it's tested. The
+            // last one is the first that fails the test.
+            s64 low = 0;
+            s64 high = 0;
+            if (*step > 0 && op == Comparison::Op::lt) {
+                low = *init;
+                high = std::max(*init, *limit + *step - 1);
+            }
+            else if (*step > 0 && op == Comparison::Op::le) {
+                low = *init;
+                high = std::max(*init, *limit + *step);
+            }
+            else if (*step < 0 && op == Comparison::Op::gt) {
+                low = std::min(*init, *limit + *step + 1);
+                high = *init;
+            }
+            else if (*step < 0 && op == Comparison::Op::ge) {
+                low = std::min(*init, *limit + *step);
+                high = *init;
+            }
+            else {
+                return false;
+            }
+
+            for (s64 value : {low, high, low * *k, high * *k, *limit * *k}) {
+                if (!fits(value)) {
+                    return false;
+                }
+            }
+
+            *var = Value(phi);
+            *bound = Value(Constant(static_cast<u64>(*limit * *k)));
+            if (*k < 0) {
+                cmp->op() = swapped(cmp->op());
+            }
+            return true;
+        }
+
+        // Removes `iv` if it's used only to compute its next value.
+        static bool remove_if_dead(const Basic& iv) {
+            auto& op = iv.update->get<BinaryOperation>();
+            for (const Use& use : iv.phi->uses()) {
+                if (&use != &op.left() && &use != &op.right()) {
+                    return false;
+                }
+            }
+            if (iv.update->uses().size() != 1) {
+                return false;
+            }
+            iv.update->block().instructions().erase(iv.update);
+            iv.phi->block().instructions().erase(iv.phi);
+            return true;
+        }
+
+        // The amount `op` adds to `phi` on each iteration, if it's
+        // loop-invariant.
+        static std::optional<Value> step(
+            const BinaryOperation& op, InstructionIterator phi,
+            const BlockSet& body
+        ) {
+            switch (op.op()) {
+                case BinaryOperation::Op::add: {
+                    if (refers_to(op.left(), phi)) {
+                        if (invariant(op.right(), body)) {
+                            return static_cast<const Value&>(op.right());
+                        }
+                    }
+                    if (refers_to(op.right(), phi)) {
+                        if (invariant(op.left(), body)) {
+                            return static_cast<const Value&>(op.left());
+                        }
+                    }
+                    break;
+                }
+                case BinaryOperation::Op::sub: {
+                    auto amount = op.right().get_if<Constant>();
+                    if (amount && refers_to(op.left(), phi)) {
+                        return Value(Constant(-amount->value()));
+                    }
+                    break;
+                }
+                default:;
+            }
+            return std::nullopt;
+        }
+
+        // The factor `k` if `inst` is `iv * k` and `k` is invariant.
+        static std::optional<Value> factor(
+            const Instruction& inst, const Basic& iv, const BlockSet& body
+        ) {
+            auto op = inst.get_if<BinaryOperation>();
+            if (!op || op->op() != BinaryOperation::Op::mul) {
+                return std::nullopt;
+            }
+            if (refers_to(op->left(), iv.phi)) {
+                if (invariant(op->right(), body)) {
+                    return static_cast<const Value&>(op->right());
+                }
+            }
+            if (refers_to(op->right(), iv.phi)) {
+                if (invariant(op->left(), body)) {
+                    return static_cast<const Value&>(op->left());
+                }
+            }
+            return std::nullopt;
+        }
+
+        static bool refers_to(const Value& value, InstructionIterator inst) {
+            auto ptr = value.get_if<InstructionIterator>();
+            return ptr && *ptr == inst;
+        }
+
+        static bool invariant(const Value& value, const BlockSet& body) {
+            if (value.get_if<Constant>()) {
+                return true;
+            }
+            auto inst = value.get_if<InstructionIterator>();
+            return inst && body.count(&(*inst)->block()) == 0;
+        }
+
+        // The value of a constant that's a valid int.
+        static std::optional<s64> constant(const Value& value) {
+            auto ptr = value.get_if<Constant>();
+            if (!ptr) {
+                return std::nullopt;
+            }
+            const s64 result = static_cast<s64>(ptr->value());
+            if (!fits(result)) {
+                return std::nullopt;
+            }
+            return result;
+        }
+
+        static bool fits(s64 value) {
+            return value >= std::numeric_limits<s32>::min() &&
+                value <= std::numeric_limits<s32>::max();
+        }
+    };
+
+    inline bool reduce_induction_variables(Function& function) {
+        return InductionVariables(function).run();
+    }
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa-loops.hpp"
+#include "ssa.hpp"
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Replaces calls to small functions with copies of their bodies. The
+     * call's block is split at the call; the callee's blocks go between
+     * the two halves, with its arguments replaced by the call's operands
+     * and its returns by jumps to the second half, where a phi merges
+     * the return values.
+     *
+     * Functions should be processed in the order given by `order()`, so
+     * that callees have already had their own calls inlined. A function
+     * is never inlined into one it can be called from, which rules out
+     * recursion.
+     */
+    class Inliner {
+        public:
+        // Callees up to this size (in instructions and blocks) are
+        // inlined. The limit is doubled for calls in loops and for
+        // functions that are called from only one place.
+        static constexpr std::size_t max_callee_size = 24;
+
+        // Inlining stops once the caller reaches this size, as the
+        // register allocators slow down on large functions.
+        static constexpr std::size_t max_caller_size = 600;
+
+        Inliner(Program& program) : m_program(program) {
+            for (Function& func : program.functions()) {
+                update(func);
+            }
+        }
+
+        // Recomputes the calls made by `func`. Must be called after
+        // `func` changes, including after calls are inlined into it.
+        void update(Function& func) {
+            auto& callees = m_callees[&func];
+            for (Function* callee : callees) {
+                m_sites[callee] -= m_calls[{&func, callee}];
+                m_calls.erase({&func, callee});
+            }
+            callees.clear();
+
+            for (BasicBlock& block : func.blocks()) {
+                for (Instruction& inst : block.instructions()) {
+                    auto call = inst.get_if<FunctionCall>();
+                    if (!call) {
+                        continue;
+                    }
+                    Function* callee = &call->function();
+                    ++m_sites[callee];
+                    if (m_calls[{&func, callee}]++ == 0) {
+                        callees.push_back(callee);
+                    }
+                }
+            }
+        }
+
+        // Every function, each after the functions it calls (except
+        // where calls form a cycle).
+        std::vector<Function*> order() const {
+            std::vector<Function*> result;
+            std::set<const Function*> visited;
+            std::vector<std::pair<Function*, std::size_t>> stack;
+
+            for (Function& root : m_program.functions()) {
+                if (!visited.insert(&root).second) {
+                    continue;
+                }
+                stack.emplace_back(&root, 0);
+                while (!stack.empty()) {
+                    auto& [func, index] = stack.back();
+                    auto& callees = m_callees.at(func);
+                    if (index < callees.size()) {
+                        Function* callee = callees[index++];
+                        if (visited.insert(callee).second) {
+                            stack.emplace_back(callee, 0);
+                        }
+                        continue;
+                    }
+                    result.push_back(func);
+                    stack.pop_back();
+                }
+            }
+            return result;
+        }
+
+        // Inlines the calls in `caller` that are worth it. Returns whether
+        // any were inlined.
+        bool inline_calls(Function& caller) {
+            std::size_t caller_size = size(caller);
+            std::vector<InstructionIterator> calls;
+            {
+                Loops loops(caller);
+                for (BasicBlock& block : caller.blocks()) {
+                    const bool in_loop = loops.depth(block) > 0;
+                    decltype(auto) instructions = block.instructions();
+                    auto end = instructions.end();
+                    for (auto it = instructions.begin(); it != end; ++it) {
+                        auto call = it->get_if<FunctionCall>();
+                        if (!call) {
+                            continue;
+                        }
+                        if (should_inline(caller, call->function(), in_loop)) {
+                            calls.push_back(it);
+                        }
+                    }
+                }
+            }
+
+            bool changed = false;
+            for (InstructionIterator call : calls) {
+                Function& callee = call->get<FunctionCall>().function();
+                const std::size_t callee_size = size(callee);
+                if (caller_size + callee_size > max_caller_size) {
+                    continue;
+                }
+                inline_call(caller, call);
+                caller_size += callee_size;
+                changed = true;
+            }
+            return changed;
+        }
+
+        private:
+        Program& m_program;
+        std::map<const Function*, std::vector<Function*>> m_callees;
+
+        // Number of calls from each function to each callee, and in
+        // total to each callee.
+        std::map<std::pair<const Function*, const Function*>, std::size_t>
+            m_calls;
+        std::map<const Function*, std::size_t> m_sites;
+
+        static std::size_t size(const Function& func) {
+            std::size_t result = 0;
+            for (const BasicBlock& block : func.blocks()) {
+                decltype(auto) instructions = block.instructions();
+                result += std::distance(
+                    instructions.begin(), instructions.end()
+                );
+                ++result;
+            }
+            return result;
+        }
+
+        bool should_inline(
+            const Function& caller, const Function& callee, bool in_loop
+        ) const {
+            if (reaches(callee, caller)) {
+                return false;
+            }
+
+            decltype(auto) blocks = callee.blocks();
+            if (blocks.begin() == blocks.end()) {
+                return false;
+            }
+            if (!blocks.begin()->predecessors().empty()) {
+                return false;
+            }
+
+            // A callee that never returns would leave the call's result
+            // undefined.
+            bool returns = false;
+            for (const BasicBlock& block : blocks) {
+                returns |= block.successors().empty();
+            }
+            if (!returns) {
+                return false;
+            }
+
+            std::size_t limit = max_callee_size;
+            if (in_loop) {
+                limit *= 2;
+            }
+            if (m_sites.at(&callee) == 1) {
+                limit *= 2;
+            }
+            return size(callee) <= limit;
+        }
+
+        // Whether `to` can be called, directly or not, from `from`.
+        bool reaches(const Function& from, const Function& to) const {
+            std::set<const Function*> seen = {&from};
+            std::vector<const Function*> stack = {&from};
+            while (!stack.empty()) {
+                const Function* func = stack.back();
+                stack.pop_back();
+                if (func == &to) {
+                    return true;
+                }
+                for (const Function* callee : m_callees.at(func)) {
+                    if (seen.insert(callee).second) {
+                        stack.push_back(callee);
+                    }
+                }
+            }
+            return false;
+        }
+
+        void inline_call(Function& caller, InstructionIterator call) {
+            BasicBlock& block = call->block();
+            Function& callee = call->get<FunctionCall>().function();
+            std::vector<Value> args;
+            for (const Value& arg : call->get<FunctionCall>().args()) {
+                args.push_back(arg);
+            }
+
+            // Split the block after the call.
+            decltype(auto) blocks = caller.blocks();
+            auto block_iter = blocks.begin();
+            while (&*block_iter != &block) {
+                ++block_iter;
+            }
+            auto rest_iter = blocks.insert(
+                std::next(block_iter), BasicBlock()
+            );
+            BasicBlock& rest = *rest_iter;
+            rest.instructions().splice(
+                rest.instructions().end(), block,
+                std::next(call), block.instructions().end()
+            );
+            block.move_terminator(rest);
+
+            std::unordered_map<const BasicBlock*, BasicBlock*> block_map;
+            for (BasicBlock& callee_block : callee.blocks()) {
+                block_map[&callee_block] = &*blocks.insert(
+                    rest_iter, BasicBlock()
+                );
+            }
+
+            // Copy the instructions. Their operands still refer to the
+            // callee until every instruction has been copied.
+            std::unordered_map<const Instruction*, Value> values;
+            for (BasicBlock& callee_block : callee.blocks()) {
+                BasicBlock& copy = *block_map.at(&callee_block);
+                for (Instruction& inst : callee_block.instructions()) {
+                    if (auto load = inst.get_if<LoadArgument>()) {
+                        values.emplace(&inst, args.at(load->index()));
+                        continue;
+                    }
+                    values.emplace(&inst, Value(clone(inst, copy, block_map)));
+                }
+            }
+
+            auto map = [&] (const Value& value) {
+                auto inst = value.get_if<InstructionIterator>();
+                return inst ? values.at(&**inst) : value;
+            };
+
+            std::vector<std::pair<BasicBlock*, Value>> returns;
+            for (BasicBlock& callee_block : callee.blocks()) {
+                BasicBlock& copy = *block_map.at(&callee_block);
+                for (Instruction& inst : copy.instructions()) {
+                    for (Use* input : inst.inputs()) {
+                        *input = map(*input);
+                    }
+                }
+
+                callee_block.terminator().visit([&] (auto& term) {
+                    using T = std::decay_t<decltype(term)>;
+                    if constexpr (std::is_same_v<T, Return>) {
+                        returns.emplace_back(&copy, map(term.value()));
+                        copy.terminate(UnconditionalBranch(rest));
+                    }
+                    else if constexpr (std::is_same_v<T, ReturnVoid>) {
+                        copy.terminate(UnconditionalBranch(rest));
+                    }
+                    else {
+                        T term_copy = term;
+                        for (BasicBlock*& target : term_copy.successors()) {
+                            target = block_map.at(target);
+                        }
+                        if constexpr (std::is_same_v<T, Branch>) {
+                            term_copy.cond() = map(term.cond());
+                        }
+                        copy.terminate(std::move(term_copy));
+                    }
+                });
+            }
+
+            if (returns.size() == 1) {
+                call->replace_all_uses_with(returns.front().second);
+            }
+            else if (!returns.empty() && !call->uses().empty()) {
+                auto phi = rest.instructions().prepend(Phi());
+                for (auto& [pred, value] : returns) {
+                    phi->get<Phi>().emplace(*pred, value);
+                }
+                call->replace_all_uses_with(Value(phi));
+            }
+
+            block.instructions().erase(call);
+            block.terminate(
+                UnconditionalBranch(*block_map.at(&*callee.blocks().begin()))
+            );
+        }
+
+        // Appends a copy of `inst` to `block`. Phi inputs are taken from
+        // the corresponding blocks in `block_map`.
+        static InstructionIterator clone(
+            Instruction& inst, BasicBlock& block,
+            const std::unordered_map<const BasicBlock*, BasicBlock*>& block_map
+        ) {
+            return inst.visit([&] (auto& obj) {
+                using T = std::decay_t<decltype(obj)>;
+                if constexpr (std::is_same_v<T, Phi>) {
+                    auto phi = block.instructions().append(Phi());
+                    for (PhiPair& pair : obj) {
+                        const Value& value = pair.value();
+                        phi->template get<Phi>().emplace(
+                            *block_map.at(&pair.block()), value
+                        );
+                    }
+                    return phi;
+                }
+                else {
+                    return block.instructions().append(obj);
+                }
+            });
+        }
+    };
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa-loops.hpp"
+#include "ssa.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <set>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Loop-invariant code motion. Operations whose operands are all
+     * defined outside a loop compute the same value on every iteration,
+     * so they are moved into the loop's preheader. Inner loops are
+     * handled first, so an operation can move out of several loops.
+     *
+     * Binary operations and comparisons can't trap, so they're safe to
+     * hoist even from code the loop doesn't always execute.
+     *
+     * Each hoisted value takes a register for the whole loop, so hoisting
+     * stops once the values live throughout the loop would fill the
+     * registers the target can allocate.
+     */
+    class LoopInvariantMotion {
+        using BlockSet = std::set<const BasicBlock*>;
+
+        public:
+        LoopInvariantMotion(Function& func, std::size_t registers) :
+        m_func(func), m_loops(func), m_registers(registers) {
+        }
+
+        // Returns whether any instruction was moved.
+        bool run() {
+            std::vector<const BasicBlock*> headers;
+            for (auto& pair : m_loops.bodies()) {
+                headers.push_back(pair.first);
+            }
+            std::sort(
+                headers.begin(), headers.end(),
+                [&] (const BasicBlock* a, const BasicBlock* b) {
+                    const std::size_t depth_a = m_loops.depth(*a);
+                    const std::size_t depth_b = m_loops.depth(*b);
+                    if (depth_a != depth_b) {
+                        return depth_a > depth_b;
+                    }
+                    return a->id() < b->id();
+                }
+            );
+
+            bool changed = false;
+            for (const BasicBlock* header : headers) {
+                changed |= hoist(*header);
+            }
+            return changed;
+        }
+
+        private:
+        Function& m_func;
+        Loops m_loops;
+        std::size_t m_registers;
+
+        bool hoist(const BasicBlock& header) {
+            const BasicBlock* pre = m_loops.preheader(header);
+            if (!pre) {
+                return false;
+            }
+
+            BasicBlock& dest = const_cast<BasicBlock&>(*pre);
+            const BlockSet& body = m_loops.bodies().at(&header);
+            std::size_t live = live_throughout(header, body);
+            bool changed = false;
+            bool progress = true;
+
+            // Hoisting an instruction can make its users invariant.
+            while (progress) {
+                progress = false;
+                for (BasicBlock& block : m_func.blocks()) {
+                    if (body.count(&block) == 0) {
+                        continue;
+                    }
+
+                    decltype(auto) instructions = block.instructions();
+                    auto it = instructions.begin();
+                    while (it != instructions.end()) {
+                        if (!invariant(*it, body)) {
+                            ++it;
+                            continue;
+                        }
+                        if (live >= m_registers) {
+                            return changed;
+                        }
+                        ++live;
+                        auto moved = it->visit([&] (auto& obj) {
+                            return dest.instructions().append(obj);
+                        });
+                        it->replace_all_uses_with(Value(moved));
+                        it = instructions.erase(it);
+                        progress = true;
+                    }
+                }
+                changed |= progress;
+            }
+            return changed;
+        }
+
+        // Estimates the number of values live throughout the loop: the
+        // header's phis, and the values defined outside the loop that are
+        // used in it.
+        std::size_t live_throughout(
+            const BasicBlock& header, const BlockSet& body
+        ) {
+            std::set<const Instruction*> outside;
+            std::size_t phis = 0;
+            auto add = [&] (const Value& value) {
+                auto def = value.get_if<InstructionIterator>();
+                if (def && body.count(&(*def)->block()) == 0) {
+                    outside.insert(&**def);
+                }
+            };
+
+            for (BasicBlock& block : m_func.blocks()) {
+                if (body.count(&block) == 0) {
+                    continue;
+                }
+                for (Instruction& inst : block.instructions()) {
+                    // Phi inputs are used only on entry to the phi's block.
+                    if (inst.get_if<Phi>()) {
+                        phis += &block == &header;
+                        continue;
+                    }
+                    for (Use* input : inst.inputs()) {
+                        add(*input);
+                    }
+                }
+                for (Use* input : block.terminator().inputs()) {
+                    add(*input);
+                }
+            }
+            return phis + outside.size();
+        }
+
+        static bool invariant(Instruction& inst, const BlockSet& body) {
+            if (!inst.get_if<BinaryOperation>()) {
+                if (!inst.get_if<Comparison>()) {
+                    return false;
+                }
+            }
+            for (Use* input : inst.inputs()) {
+                auto def = input->get_if<InstructionIterator>();
+                if (def && body.count(&(*def)->block()) > 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    inline bool
+    hoist_loop_invariants(Function& function, std::size_t registers) {
+        insert_preheaders(function);
+        return LoopInvariantMotion(function, registers).run();
+    }
+}
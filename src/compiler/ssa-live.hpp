@@ -18,13 +18,18 @@
  */
 
 #pragma once
+#include "bitset.hpp"
 #include "ssa.hpp"
 #include "../utils.hpp"
 #include <cstddef>
 #include <functional>
+#include <list>
 #include <map>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace fish::java::ssa::live {
     using InstIter = InstructionIterator;
@@ -50,6 +55,23 @@ namespace fish::java::ssa::live {
     // Maps a place to the instructions that are live at that place
     using LiveVarMap = std::map<const void*, InstSet>;
 
+    // The place right after `inst`: the next instruction, or the block's
+    // terminator if `inst` is the last instruction.
+    inline const void* next_place(InstIter inst) {
+        auto next = inst;
+        ++next;
+        if (next == inst->block().instructions().end()) {
+            return &inst->block().terminator();
+        }
+        return &*next;
+    }
+
+    /**
+     * Finds where each value is live. Values are numbered densely, so the
+     * live sets at the start and end of each block are bitsets, which are
+     * solved for with a worklist. Per-instruction results are built once
+     * the block sets are final.
+     */
     class LifeMapBuilder {
         using Block = const BasicBlock;
         using Inst = const Instruction;
@@ -61,7 +83,11 @@ namespace fish::java::ssa::live {
             if (blocks.begin() == blocks.end()) {
                 return;
             }
-            while (calculate_once());
+            number();
+            solve();
+            for (Block& block : m_func.blocks()) {
+                record(block);
+            }
         }
 
         LifeMap& life_map() {
@@ -73,6 +99,27 @@ namespace fish::java::ssa::live {
         }
 
         private:
+        struct BlockSets {
+            // Values used in the block before being defined there.
+            BitSet uses;
+
+            // Values defined in the block, including by phis.
+            BitSet defs;
+
+            // Inputs of successors' phis that come from this block.
+            BitSet phi_uses;
+
+            BitSet live_in;
+            BitSet live_out;
+        };
+
+        const Function& m_func;
+        std::vector<InstIter> m_values;
+        std::unordered_map<Inst*, std::size_t> m_indices;
+        std::unordered_map<Block*, BlockSets> m_sets;
+        LiveVarMap m_live_var_map;
+        LifeMap m_life_map;
+
         InstSet inputs(InstIter inst) {
             InstSet result;
             inst->visit([&] (auto& obj) {
@@ -180,109 +227,174 @@ namespace fish::java::ssa::live {
             return result;
         }
 
-        InstSet block_live_start(Block& block, Block& pred) {
-            InstSet live = m_live[&block];
-            for (Inst& inst : block.instructions()) {
-                auto ptr = inst.get_if<Phi>();
-                if (!ptr) {
-                    break;
+        template <typename T>
+        void insert(InstSet& set, T&& value) const {
+            if (auto ptr = value.template get_if<InstIter>()) {
+                set.insert(*ptr);
+            }
+        }
+
+        // Numbers every instruction and finds each block's uses and defs.
+        void number() {
+            for (Block& block : m_func.blocks()) {
+                // Must remove const to get non-const Instruction iterators.
+                decltype(auto) instructions = (
+                    const_cast<BasicBlock&>(block).instructions()
+                );
+                auto it = instructions.begin();
+                auto end = instructions.end();
+                for (; it != end; ++it) {
+                    m_indices.emplace(&*it, m_values.size());
+                    m_values.push_back(it);
                 }
+            }
+
+            const std::size_t size = m_values.size();
+            for (Block& block : m_func.blocks()) {
+                BlockSets& sets = m_sets[&block];
+                sets.uses = sets.defs = sets.phi_uses = BitSet(size);
+                sets.live_in = sets.live_out = BitSet(size);
+            }
 
-                const Phi& phi = *ptr;
-                for (auto& pair : phi) {
-                    if (&pair.block() != &pred) {
-                        continue;
+            for (Block& block : m_func.blocks()) {
+                BlockSets& sets = m_sets.at(&block);
+                for (InstIter in : inputs(block.terminator())) {
+                    sets.uses.set(index(in));
+                }
+
+                decltype(auto) instructions = (
+                    const_cast<BasicBlock&>(block).instructions()
+                );
+                auto it = instructions.end();
+                auto begin = instructions.begin();
+                while (it != begin) {
+                    --it;
+                    for (InstIter out : outputs(it)) {
+                        sets.defs.set(index(out));
+                        sets.uses.reset(index(out));
+                    }
+                    for (InstIter in : inputs(it)) {
+                        sets.uses.set(index(in));
                     }
 
-                    auto ptr = pair.value().get_if<InstIter>();
-                    if (ptr) {
-                        InstIter inst = *ptr;
-                        live.insert(inst);
+                    auto phi = it->get_if<Phi>();
+                    if (!phi) continue;
+                    for (auto& pair : *phi) {
+                        auto ptr = pair.value().get_if<InstIter>();
+                        if (!ptr) continue;
+                        m_sets.at(&pair.block()).phi_uses.set(index(*ptr));
                     }
                 }
             }
-            return live;
         }
 
-        InstSet block_live_end(Block& block) {
-            Term& term = block.terminator();
-            InstSet live = inputs(term);
-            term.visit([&] (auto& obj) {
-                for (Block* succ : obj.successors()) {
-                    for (InstIter inst : block_live_start(*succ, block)) {
-                        live.insert(inst);
+        std::size_t index(InstIter inst) const {
+            return m_indices.at(&*inst);
+        }
+
+        // Blocks in postorder, followed by any unreachable blocks. Visiting
+        // successors first makes a backward analysis converge sooner.
+        std::vector<Block*> postorder() const {
+            std::vector<Block*> result;
+            std::unordered_map<Block*, bool> visited;
+            std::vector<std::pair<Block*, bool>> stack;
+            stack.emplace_back(&*m_func.blocks().begin(), false);
+            while (!stack.empty()) {
+                auto [block, done] = stack.back();
+                stack.pop_back();
+                if (done) {
+                    result.push_back(block);
+                    continue;
+                }
+                if (visited[block]) continue;
+                visited[block] = true;
+                stack.emplace_back(block, true);
+                for (Block* succ : block->successors()) {
+                    if (!visited[succ]) {
+                        stack.emplace_back(succ, false);
                     }
                 }
-            });
-            return live;
-        }
+            }
 
-        template <typename T>
-        void insert(InstSet& set, T&& value) const {
-            if (auto ptr = value.template get_if<InstIter>()) {
-                set.insert(*ptr);
+            for (Block& block : m_func.blocks()) {
+                if (!visited[&block]) {
+                    result.push_back(&block);
+                }
             }
+            return result;
         }
 
-        bool calculate_once() {
-            decltype(auto) blocks = m_func.blocks();
-            auto it = blocks.end();
-            auto begin = blocks.begin();
-            bool changed = false;
-
-            do {
-                Block& block = *--it;
-                changed |= calculate(block);
-            } while (it != begin);
-            return changed;
+        // Finds the values live at the start and end of each block.
+        void solve() {
+            std::vector<Block*> order = postorder();
+            std::list<Block*> worklist(order.begin(), order.end());
+            std::unordered_map<Block*, bool> queued;
+            for (Block* block : order) {
+                queued[block] = true;
+            }
+
+            while (!worklist.empty()) {
+                Block* block = worklist.front();
+                worklist.pop_front();
+                queued[block] = false;
+
+                BlockSets& sets = m_sets.at(block);
+                sets.live_out = sets.phi_uses;
+                for (Block* succ : block->successors()) {
+                    sets.live_out.merge(m_sets.at(succ).live_in);
+                }
+
+                BitSet live_in = sets.live_out;
+                live_in.subtract(sets.defs);
+                live_in.merge(sets.uses);
+                if (live_in == sets.live_in) continue;
+                sets.live_in = std::move(live_in);
+
+                for (Block* pred : block->predecessors()) {
+                    if (!queued[pred]) {
+                        queued[pred] = true;
+                        worklist.push_back(pred);
+                    }
+                }
+            }
         }
 
-        bool calculate(Block& block) {
-            InstSet live = block_live_end(block);
-            for (InstIter inst : live) {
-                const void* ptr = &block.terminator();
-                m_life_map[inst].insert(ptr);
-                m_live_var_map[ptr].insert(inst);
+        // Records the values live at each place in `block`.
+        void record(Block& block) {
+            InstSet live;
+            auto mark = [&] (const void* place) {
+                if (live.empty()) return;
+                m_live_var_map.emplace(place, live);
+                for (InstIter inst : live) {
+                    m_life_map[inst].insert(place);
+                }
+            };
+
+            m_sets.at(&block).live_out.for_each([&] (std::size_t i) {
+                live.insert(m_values[i]);
+            });
+            for (InstIter in : inputs(block.terminator())) {
+                live.insert(in);
             }
+            mark(&block.terminator());
 
             // Must remove const to get non-const Instruction iterators.
             decltype(auto) instructions = (
                 const_cast<BasicBlock&>(block).instructions()
             );
-
             auto it = instructions.end();
             auto begin = instructions.begin();
-
             while (it != begin) {
-                Inst& inst = *--it;
-                InstSet inputs = this->inputs(it);
-                InstSet outputs = this->outputs(it);
-                for (InstIter out : outputs) {
+                --it;
+                for (InstIter out : outputs(it)) {
                     live.erase(out);
                 }
-                for (InstIter in : inputs) {
+                for (InstIter in : inputs(it)) {
                     live.insert(in);
                 }
-                for (InstIter in : live) {
-                    const void* ptr = &inst;
-                    m_life_map[in].insert(ptr);
-                    m_live_var_map[ptr].insert(in);
-                }
+                mark(&*it);
             }
-
-            InstSet& prev = m_live[&block];
-            if (live == prev) {
-                return false;
-            }
-            prev = live;
-            return true;
         }
-
-        private:
-        const Function& m_func;
-        std::map<Block*, InstSet> m_live;
-        LiveVarMap m_live_var_map;
-        LifeMap m_life_map;
     };
 
     class InterferenceMap {
@@ -373,6 +485,34 @@ namespace fish::java::ssa::live {
             }
         }
 
+        bool contains(InstIter inst) const {
+            return m_map.count(inst) > 0;
+        }
+
+        bool interferes(InstIter inst1, InstIter inst2) const {
+            auto it = m_map.find(inst1);
+            return it != m_map.end() && it->second.count(inst2) > 0;
+        }
+
+        const InstSet& neighbors(InstIter inst) const {
+            return m_map.at(inst);
+        }
+
+        // Combines `from` into `into`, which then interferes with
+        // everything either one did.
+        void merge(InstIter into, InstIter from) {
+            auto it = m_map.find(from);
+            InstSet neighbors = std::move(it->second);
+            m_map.erase(it);
+            InstSet& set = m_map[into];
+            for (InstIter neighbor : neighbors) {
+                auto& other = m_map.at(neighbor);
+                other.erase(from);
+                other.insert(into);
+                set.insert(neighbor);
+            }
+        }
+
         private:
         Map m_map;
     };
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "dominators.hpp"
+#include "ssa.hpp"
+#include <cstddef>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Finds the natural loops of a function. A loop is identified by its
+     * header, which dominates every block in the loop; loops that share a
+     * header are treated as one. Loops are either disjoint or nested, and
+     * each loop records the innermost loop that contains it.
+     */
+    class Loops {
+        using Block = const BasicBlock;
+        using BlockSet = std::set<Block*>;
+
+        public:
+        Loops(const Function& func) {
+            decltype(auto) blocks = func.blocks();
+            if (blocks.begin() == blocks.end()) {
+                return;
+            }
+
+            Dominators doms(func);
+            for (Block& block : blocks) {
+                for (Block* succ : block.successors()) {
+                    // An edge to a dominator is a back edge.
+                    if (doms.dominates(*succ, block)) {
+                        add_back_edge(*succ, block);
+                    }
+                }
+            }
+
+            for (auto& [header, body] : m_bodies) {
+                for (Block* block : body) {
+                    ++m_depths[block];
+                }
+            }
+
+            // The innermost enclosing loop is the smallest one whose body
+            // contains the header.
+            for (auto& [header, body] : m_bodies) {
+                Block* parent = nullptr;
+                for (auto& [other, other_body] : m_bodies) {
+                    if (other == header || other_body.count(header) == 0) {
+                        continue;
+                    }
+                    if (!parent || other_body.size() < size(*parent)) {
+                        parent = other;
+                    }
+                }
+                m_parents[header] = parent;
+            }
+        }
+
+        // Maps each loop header to the blocks in its loop, including the
+        // header itself.
+        const std::map<Block*, BlockSet>& bodies() const {
+            return m_bodies;
+        }
+
+        // The number of loops that contain `block`.
+        std::size_t depth(Block& block) const {
+            auto it = m_depths.find(&block);
+            return it == m_depths.end() ? 0 : it->second;
+        }
+
+        // The header of the innermost loop that contains the loop of
+        // `header`, or null if it is outermost.
+        Block* parent(Block& header) const {
+            return m_parents.at(&header);
+        }
+
+        // The block through which the loop of `header` is always entered:
+        // its only predecessor outside the loop, provided the header is
+        // that block's only successor. Returns null if there is none.
+        Block* preheader(Block& header) const {
+            const BlockSet& body = m_bodies.at(&header);
+            Block* result = nullptr;
+            for (Block* pred : header.predecessors()) {
+                if (body.count(pred) > 0) {
+                    continue;
+                }
+                if (result) {
+                    return nullptr;
+                }
+                result = pred;
+            }
+            if (!result || result->successors().size() != 1) {
+                return nullptr;
+            }
+            return result;
+        }
+
+        private:
+        std::map<Block*, BlockSet> m_bodies;
+        std::map<Block*, std::size_t> m_depths;
+        std::map<Block*, Block*> m_parents;
+
+        std::size_t size(Block& header) const {
+            return m_bodies.at(&header).size();
+        }
+
+        // Adds the blocks that can reach `latch` without passing through
+        // `header` to the loop of `header`.
+        void add_back_edge(Block& header, Block& latch) {
+            BlockSet& body = m_bodies[&header];
+            body.insert(&header);
+
+            std::list<Block*> stack;
+            if (body.insert(&latch).second) {
+                stack.push_back(&latch);
+            }
+            while (!stack.empty()) {
+                Block* block = stack.back();
+                stack.pop_back();
+                for (Block* pred : block->predecessors()) {
+                    if (body.insert(pred).second) {
+                        stack.push_back(pred);
+                    }
+                }
+            }
+        }
+    };
+
+    /**
+     * Gives every loop a preheader (see `Loops::preheader()`), inserted
+     * just before the header. Phi inputs from outside the loop are moved
+     * into the preheader, merged by a new phi if there are several.
+     * Returns whether any block was added.
+     */
+    inline bool insert_preheaders(Function& func) {
+        Loops loops(func);
+        decltype(auto) blocks = func.blocks();
+        const BasicBlock* entry = &*blocks.begin();
+        bool changed = false;
+
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            BasicBlock& header = *it;
+            auto body_iter = loops.bodies().find(&header);
+            if (body_iter == loops.bodies().end()) {
+                continue;
+            }
+            if (loops.preheader(header)) {
+                continue;
+            }
+
+            auto& body = body_iter->second;
+            std::vector<BasicBlock*> outside;
+            for (BasicBlock* pred : header.predecessors()) {
+                if (body.count(pred) == 0) {
+                    outside.push_back(pred);
+                }
+            }
+            if (outside.empty() && &header != entry) {
+                // Unreachable.
+                continue;
+            }
+
+            BasicBlock& pre = *blocks.insert(it, BasicBlock());
+            for (auto& inst : header.instructions()) {
+                auto phi = inst.get_if<Phi>();
+                if (!phi) {
+                    break;
+                }
+
+                std::vector<Phi::iterator> moved;
+                for (auto pair = phi->begin(); pair != phi->end(); ++pair) {
+                    if (body.count(&pair->block()) == 0) {
+                        moved.push_back(pair);
+                    }
+                }
+                if (moved.empty()) {
+                    continue;
+                }
+
+                const Value& first = moved.front()->value();
+                Value value = first;
+                if (moved.size() > 1) {
+                    auto merged = pre.instructions().append(Phi());
+                    for (auto pair : moved) {
+                        const Value& input = pair->value();
+                        merged->get<Phi>().emplace(pair->block(), input);
+                    }
+                    value = Value(merged);
+                }
+                for (auto pair : moved) {
+                    phi->erase(pair);
+                }
+                phi->emplace(pre, value);
+            }
+
+            pre.terminate(UnconditionalBranch(header));
+            for (BasicBlock* pred : outside) {
+                pred->retarget(header, pre);
+            }
+            changed = true;
+        }
+        return changed;
+    }
+}
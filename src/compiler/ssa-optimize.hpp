@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa.hpp"
+#include "dominators.hpp"
+#include "ssa-cfg.hpp"
+#include "ssa-constants.hpp"
+#include "ssa-gvn.hpp"
+#include "ssa-induction.hpp"
+#include "ssa-inline.hpp"
+#include "ssa-licm.hpp"
+#include "ssa-tail.hpp"
+#include <algorithm>
+#include <set>
+#include <vector>
+
+namespace fish::java::ssa {
+    // Makes the uses of each move use the value it copies instead. The
+    // moves themselves are left for eliminate_unused().
+    //
+    // Moves that feed a phi along a back edge keep that use. They split
+    // the loop-carried value's live range in two, which lets the coloring
+    // allocator coalesce the value with the phi one step at a time when
+    // registers are scarce.
+    inline bool propagate_copies(Function& function) {
+        Dominators doms(function);
+        std::vector<InstructionIterator> moves;
+        std::set<const Use*> back_edge_uses;
+        for (BasicBlock& block : function.blocks()) {
+            auto it = block.instructions().begin();
+            auto end = block.instructions().end();
+            for (; it != end; ++it) {
+                if (it->get_if<Move>()) {
+                    moves.push_back(it);
+                }
+                auto phi = it->get_if<Phi>();
+                if (!phi) {
+                    continue;
+                }
+                for (auto& pair : *phi) {
+                    auto ptr = pair.value().get_if<InstructionIterator>();
+                    if (
+                        ptr && (*ptr)->get_if<Move>() &&
+                        doms.dominates(block, pair.block())
+                    ) {
+                        back_edge_uses.insert(&pair.value());
+                    }
+                }
+            }
+        }
+
+        // Returns whether any use was replaced.
+        std::vector<Use*> uses;
+        auto replace_uses = [&] (Instruction& inst, const Value& value) {
+            uses.clear();
+            for (Use& use : inst.uses()) {
+                if (back_edge_uses.count(&use) == 0) {
+                    uses.push_back(&use);
+                }
+            }
+            for (Use* use : uses) {
+                *use = value;
+            }
+            return !uses.empty();
+        };
+
+        bool changed = false;
+        std::vector<InstructionIterator> chain;
+        for (InstructionIterator move : moves) {
+            // Follow chains of moves to the original value. Every move
+            // in the chain is made to copy that value directly, so each
+            // chain is followed only once.
+            chain.assign(1, move);
+            Value value = move->get<Move>().value();
+            while (auto ptr = value.get_if<InstructionIterator>()) {
+                auto next = (*ptr)->get_if<Move>();
+                if (!next) break;
+                chain.push_back(*ptr);
+                value = next->value();
+            }
+
+            // The last move in the chain already copies `value`.
+            for (std::size_t i = 0; i < chain.size(); ++i) {
+                changed |= replace_uses(*chain[i], value);
+                if (i + 1 < chain.size()) {
+                    chain[i]->get<Move>().value() = value;
+                    changed = true;
+                }
+            }
+        }
+        return changed;
+    }
+
+    // Removes instructions that have no uses and no side effects,
+    // including those whose only uses were removed.
+    inline bool eliminate_unused(Function& function) {
+        auto unused = [] (const Instruction& inst) {
+            return inst.uses().empty() && !inst.has_side_effect();
+        };
+
+        std::vector<InstructionIterator> work_list;
+        for (BasicBlock& block : function.blocks()) {
+            auto it = block.instructions().begin();
+            auto end = block.instructions().end();
+            for (; it != end; ++it) {
+                if (unused(*it)) {
+                    work_list.push_back(it);
+                }
+            }
+        }
+
+        const bool changed = !work_list.empty();
+        std::vector<InstructionIterator> inputs;
+        while (!work_list.empty()) {
+            InstructionIterator inst = work_list.back();
+            work_list.pop_back();
+
+            inputs.clear();
+            for (Use* input : inst->inputs()) {
+                auto ptr = input->get_if<InstructionIterator>();
+                if (ptr && *ptr != inst) {
+                    inputs.push_back(*ptr);
+                }
+            }
+            inst->block().instructions().erase(inst);
+
+            // An instruction can be used more than once by `inst`.
+            std::sort(inputs.begin(), inputs.end(), [] (auto a, auto b) {
+                return &*a < &*b;
+            });
+            auto last = std::unique(inputs.begin(), inputs.end());
+            for (auto it = inputs.begin(); it != last; ++it) {
+                if (unused(**it)) {
+                    work_list.push_back(*it);
+                }
+            }
+        }
+        return changed;
+    }
+
+    // `registers` is the number of registers the target can allocate.
+    inline void optimize(Function& function, std::size_t registers) {
+        propagate_copies(function);
+        propagate_constants(function);
+        eliminate_unused(function);
+        simplify_cfg(function);
+        eliminate_tail_recursion(function);
+        number_values(function);
+        hoist_loop_invariants(function, registers);
+        reduce_induction_variables(function);
+        eliminate_unused(function);
+        simplify_cfg(function);
+    }
+
+    // Optimizes every function, inlining calls where it's worth it.
+    inline void optimize(Program& program, std::size_t registers) {
+        for (Function& function : program.functions()) {
+            optimize(function, registers);
+        }
+        Inliner inliner(program);
+        for (Function* function : inliner.order()) {
+            if (inliner.inline_calls(*function)) {
+                optimize(*function, registers);
+                inliner.update(*function);
+            }
+        }
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa.hpp"
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fish::java::ssa {
+    /**
+     * Turns self tail calls (calls to the function itself whose result
+     * is returned directly) into jumps back to the start of the
+     * function. The arguments are loaded by a new entry block, and the
+     * old entry block becomes a loop header with a phi for each
+     * argument, merging the initial values with the operands of each
+     * tail call.
+     */
+    class TailRecursion {
+        public:
+        TailRecursion(Function& func) : m_func(func) {
+        }
+
+        // Returns whether any calls were replaced.
+        bool run() {
+            decltype(auto) blocks = m_func.blocks();
+            if (blocks.begin() == blocks.end()) {
+                return false;
+            }
+
+            // The old entry block can't already have phis, as they would
+            // have no value for the new entry block.
+            BasicBlock& header = *blocks.begin();
+            for (Instruction& inst : header.instructions()) {
+                if (inst.get_if<Phi>()) {
+                    return false;
+                }
+            }
+
+            std::vector<InstructionIterator> calls;
+            for (BasicBlock& block : blocks) {
+                if (auto call = tail_call(block)) {
+                    calls.push_back(*call);
+                }
+            }
+            if (calls.empty()) {
+                return false;
+            }
+
+            BasicBlock& entry = *blocks.insert(blocks.begin(), BasicBlock());
+            std::vector<std::pair<std::size_t, InstructionIterator>> phis;
+            for (BasicBlock& block : blocks) {
+                if (&block == &entry) {
+                    continue;
+                }
+                decltype(auto) instructions = block.instructions();
+                auto it = instructions.begin();
+                while (it != instructions.end()) {
+                    auto next = std::next(it);
+                    if (auto load = it->get_if<LoadArgument>()) {
+                        entry.instructions().splice(
+                            entry.instructions().end(), block, it, next
+                        );
+                        auto phi = header.instructions().prepend(Phi());
+                        it->replace_all_uses_with(Value(phi));
+                        phi->get<Phi>().emplace(entry, Value(it));
+                        phis.emplace_back(load->index(), phi);
+                    }
+                    it = next;
+                }
+            }
+            entry.terminate(UnconditionalBranch(header));
+
+            // The arguments of each call now refer to the phis.
+            for (InstructionIterator call : calls) {
+                BasicBlock& block = call->block();
+                std::vector<Value> args;
+                for (const Value& arg : call->get<FunctionCall>().args()) {
+                    args.push_back(arg);
+                }
+                block.terminate(UnconditionalBranch(header));
+                block.instructions().erase(call);
+                for (auto& [index, phi] : phis) {
+                    phi->get<Phi>().emplace(block, args.at(index));
+                }
+            }
+            return true;
+        }
+
+        private:
+        Function& m_func;
+
+        // The call that ends `block` if its result (if any) is returned
+        // right after.
+        std::optional<InstructionIterator> tail_call(BasicBlock& block) {
+            decltype(auto) instructions = block.instructions();
+            auto last = instructions.end();
+            if (last == instructions.begin()) {
+                return std::nullopt;
+            }
+            --last;
+            auto call = last->get_if<FunctionCall>();
+            if (!call || &call->function() != &m_func) {
+                return std::nullopt;
+            }
+
+            return block.terminator().visit([&] (const auto& term) {
+                using T = std::decay_t<decltype(term)>;
+                std::optional<InstructionIterator> result;
+                if constexpr (std::is_same_v<T, Return>) {
+                    auto value = term.value().template get_if<
+                        InstructionIterator
+                    >();
+                    if (value && &**value == &*last) {
+                        result = last;
+                    }
+                }
+                else if constexpr (std::is_same_v<T, ReturnVoid>) {
+                    result = last;
+                }
+                return result;
+            });
+        }
+    };
+
+    inline bool eliminate_tail_recursion(Function& function) {
+        return TailRecursion(function).run();
+    }
+}
@@ -18,12 +18,14 @@
  */
 
 #pragma once
+#include "arena.hpp"
 #include "../typedefs.hpp"
 #include "../utils.hpp"
 #include "java.hpp"
 #include <array>
 #include <cassert>
 #include <cstddef>
+#include <iterator>
 #include <list>
 #include <optional>
 #include <ostream>
@@ -39,7 +41,7 @@ namespace fish::java::ssa {
     class Function;
     class BasicBlock;
 
-    using InstructionList = std::list<Instruction>;
+    using InstructionList = ArenaList<Instruction>;
     using InstructionIterator = InstructionList::iterator;
     using ConstInstructionIterator = InstructionList::const_iterator;
 
@@ -105,6 +107,190 @@ namespace fish::java::ssa {
         operator<<(std::ostream& stream, const Value& self);
     };
 
+    /**
+     * An operand of an instruction or terminator. Every instruction keeps
+     * a list of the operands that refer to it (its def-use chain), which
+     * is updated whenever an operand is set, so the uses of an
+     * instruction can be found without scanning the function.
+     *
+     * Values stored anywhere other than in an operand are not uses.
+     */
+    class Use {
+        template <typename T>
+        using EnableIfValue = std::enable_if_t<
+            !std::is_same_v<std::decay_t<T>, Use>
+        >;
+
+        public:
+        Use() = default;
+
+        template <typename T, typename = EnableIfValue<T>>
+        explicit Use(T&& value) : m_value(std::forward<T>(value)) {
+            link();
+        }
+
+        Use(const Use& other) : m_value(other.m_value) {
+            link();
+        }
+
+        ~Use() {
+            unlink();
+        }
+
+        Use& operator=(const Use& other) {
+            return *this = other.m_value;
+        }
+
+        Use& operator=(const Value& value) {
+            unlink();
+            m_value = value;
+            link();
+            return *this;
+        }
+
+        template <typename Fn>
+        decltype(auto) visit(Fn&& func) const {
+            return m_value.visit(std::forward<Fn>(func));
+        }
+
+        template <typename T>
+        decltype(auto) get() const {
+            return m_value.get<T>();
+        }
+
+        template <typename T>
+        decltype(auto) get_if() const {
+            return m_value.get_if<T>();
+        }
+
+        operator const Value&() const {
+            return m_value;
+        }
+
+        private:
+        friend class UseList;
+
+        Value m_value;
+        Use* m_next = nullptr;
+        // The pointer that points to this use, or null if unlinked.
+        Use** m_prev = nullptr;
+
+        inline void link();
+
+        void unlink() {
+            if (!m_prev) {
+                return;
+            }
+            *m_prev = m_next;
+            if (m_next) {
+                m_next->m_prev = m_prev;
+            }
+            m_next = nullptr;
+            m_prev = nullptr;
+        }
+
+        friend std::ostream&
+        operator<<(std::ostream& stream, const Use& self) {
+            stream << self.m_value;
+            return stream;
+        }
+    };
+
+    /**
+     * The uses of an instruction. Copies of an instruction start with no
+     * uses, as operands refer to instructions by position in their
+     * block. When an instruction is destroyed, its remaining uses are
+     * detached (but still refer to it).
+     */
+    class UseList {
+        public:
+        class iterator {
+            public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Use;
+            using difference_type = std::ptrdiff_t;
+            using pointer = Use*;
+            using reference = Use&;
+
+            iterator(Use* use = nullptr) : m_use(use) {
+            }
+
+            Use& operator*() const {
+                return *m_use;
+            }
+
+            Use* operator->() const {
+                return m_use;
+            }
+
+            iterator& operator++() {
+                m_use = m_use->m_next;
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator old = *this;
+                ++*this;
+                return old;
+            }
+
+            bool operator==(const iterator& other) const {
+                return m_use == other.m_use;
+            }
+
+            bool operator!=(const iterator& other) const {
+                return !(*this == other);
+            }
+
+            private:
+            Use* m_use = nullptr;
+        };
+
+        UseList() = default;
+
+        UseList(const UseList&) {
+        }
+
+        UseList& operator=(const UseList&) {
+            return *this;
+        }
+
+        ~UseList() {
+            while (m_first) {
+                m_first->unlink();
+            }
+        }
+
+        iterator begin() const {
+            return m_first;
+        }
+
+        iterator end() const {
+            return nullptr;
+        }
+
+        bool empty() const {
+            return !m_first;
+        }
+
+        std::size_t size() const {
+            return std::distance(begin(), end());
+        }
+
+        private:
+        friend class Use;
+        Use* m_first = nullptr;
+
+        void push(Use& use) {
+            use.m_next = m_first;
+            use.m_prev = &m_first;
+            if (m_first) {
+                m_first->m_prev = &use.m_next;
+            }
+            m_first = &use;
+        }
+    };
+
     class UnaryInst {
         protected:
         UnaryInst() = default;
@@ -123,7 +309,7 @@ namespace fish::java::ssa {
         }
 
         private:
-        Value m_value;
+        Use m_value;
     };
 
     class Move : public UnaryInst {
@@ -166,8 +352,8 @@ namespace fish::java::ssa {
         }
 
         private:
-        Value m_left;
-        Value m_right;
+        Use m_left;
+        Use m_right;
     };
 
     class BinaryOperation : public BinaryInst {
@@ -310,7 +496,7 @@ namespace fish::java::ssa {
         }
 
         private:
-        Value m_cond;
+        Use m_cond;
         std::array<BasicBlock*, 2> m_targets = {nullptr, nullptr};
 
         friend std::ostream&
@@ -376,7 +562,7 @@ namespace fish::java::ssa {
         }
 
         private:
-        std::list<Value> m_args;
+        ArenaList<Use> m_args;
     };
 
     class FunctionCall : public BaseFunctionCall {
@@ -460,14 +646,14 @@ namespace fish::java::ssa {
 
         private:
         BasicBlock* m_block = nullptr;
-        Value m_value;
+        Use m_value;
 
         friend std::ostream&
         operator<<(std::ostream& stream, const PhiPair& self);
     };
 
     class Phi {
-        using Container = std::list<PhiPair>;
+        using Container = ArenaList<PhiPair>;
 
         public:
         using value_type = Container::value_type;
@@ -623,6 +809,7 @@ namespace fish::java::ssa {
         }
 
         private:
+        friend class BasicBlock;
         BasicBlock* m_block = nullptr;
     };
 
@@ -634,12 +821,30 @@ namespace fish::java::ssa {
             return m_id;
         }
 
-        std::list<Value*> inputs();
+        // The values this instruction uses. These are temporary, so they
+        // aren't allocated from the arena, which is only freed once the
+        // whole compilation is done.
+        std::vector<Use*> inputs();
         bool has_side_effect() const;
 
+        const UseList& uses() const {
+            return m_uses;
+        }
+
+        // Makes every use of this instruction use `value` instead.
+        void replace_all_uses_with(const Value& value) {
+            [[maybe_unused]] auto ptr = value.get_if<InstructionIterator>();
+            assert(!ptr || &**ptr != this);
+            while (!m_uses.empty()) {
+                *m_uses.begin() = value;
+            }
+        }
+
         private:
+        friend class Use;
         static inline std::size_t s_id = 0;
         std::size_t m_id = s_id++;
+        UseList m_uses;
 
         friend std::ostream&
         operator<<(std::ostream& stream, const Instruction& self) {
@@ -651,8 +856,14 @@ namespace fish::java::ssa {
         }
     };
 
-    inline std::list<Value*> Instruction::inputs() {
-        std::list<Value*> result;
+    inline void Use::link() {
+        if (auto ptr = m_value.get_if<InstructionIterator>()) {
+            (*ptr)->m_uses.push(*this);
+        }
+    }
+
+    inline std::vector<Use*> Instruction::inputs() {
+        std::vector<Use*> result;
         visit([&] (auto& obj) {
             using T = std::decay_t<decltype(obj)>;
             if constexpr (std::is_same_v<T, Move>) {
@@ -738,8 +949,9 @@ namespace fish::java::ssa {
         public:
         using BlockChild::BlockChild;
 
-        std::list<Value*> inputs() {
-            std::list<Value*> result;
+        // See Instruction::inputs().
+        std::vector<Use*> inputs() {
+            std::vector<Use*> result;
             visit([&] (auto& obj) {
                 using T = std::decay_t<decltype(obj)>;
                 if constexpr (std::is_same_v<T, UnconditionalBranch>) {
@@ -811,6 +1023,20 @@ namespace fish::java::ssa {
                 return m_self.m_instructions.erase(pos);
             }
 
+            // Moves [first, last) from `other` to before `pos`. Iterators
+            // to the moved instructions remain valid.
+            void splice(
+                InstructionIterator pos, BasicBlock& other,
+                InstructionIterator first, InstructionIterator last
+            ) {
+                for (auto it = first; it != last; ++it) {
+                    it->m_block = &m_self;
+                }
+                m_self.m_instructions.splice(
+                    pos, other.m_instructions, first, last
+                );
+            }
+
             private:
             Self& m_self;
         };
@@ -849,6 +1075,23 @@ namespace fish::java::ssa {
             return *m_terminator;
         }
 
+        // Makes the terminator branch to `to` instead of `from`.
+        void retarget(BasicBlock& from, BasicBlock& to) {
+            terminator().visit([&] (auto& term) {
+                for (BasicBlock*& target : term.successors()) {
+                    if (target == &from) {
+                        target = &to;
+                    }
+                }
+            });
+            clear_successors();
+            terminator().visit([&] (auto& term) {
+                for (BasicBlock* block : term.successors()) {
+                    add_successor(*block);
+                }
+            });
+        }
+
         const auto& predecessors() const {
             return m_predecessors;
         }
@@ -857,13 +1100,37 @@ namespace fish::java::ssa {
             return m_successors;
         }
 
+        // Moves the terminator to `to`, which replaces this block as a
+        // predecessor of its successors. This block keeps a copy of the
+        // terminator until it is given another one.
+        void move_terminator(BasicBlock& to) {
+            terminator().visit([&] (const auto& term) {
+                to.terminate(term);
+            });
+            for (BasicBlock* succ : to.successors()) {
+                for (Instruction& inst : succ->instructions()) {
+                    auto phi = inst.get_if<Phi>();
+                    if (!phi) {
+                        break;
+                    }
+                    auto pair = phi->begin();
+                    while (&pair->block() != this) {
+                        ++pair;
+                    }
+                    const Value& value = pair->value();
+                    phi->emplace(to, value);
+                    phi->erase(pair);
+                }
+            }
+        }
+
         std::size_t id() const {
             return m_id;
         }
 
-        std::vector<std::pair<InstructionIterator, Value*>>
+        std::vector<std::pair<InstructionIterator, Use*>>
         phis(BasicBlock& block) {
-            std::vector<std::pair<InstructionIterator, Value*>> result;
+            std::vector<std::pair<InstructionIterator, Use*>> result;
             auto it = instructions().begin();
             auto end = instructions().end();
 
@@ -975,7 +1242,7 @@ namespace fish::java::ssa {
 
     class Function {
         public:
-        using BlockList = std::list<BasicBlock>;
+        using BlockList = ArenaList<BasicBlock>;
         using BlockIterator = BlockList::iterator;
 
         template <typename Self>
@@ -1059,7 +1326,7 @@ namespace fish::java::ssa {
         std::size_t m_nargs = 0;
         std::size_t m_nreturn = 0;
         std::string m_name;
-        std::list<BasicBlock> m_blocks;
+        BlockList m_blocks;
         std::size_t m_stack_slots = 0;
 
         friend std::ostream&
@@ -19,14 +19,19 @@
 
 #pragma once
 #include "ssa-live.hpp"
+#include "ssa-loops.hpp"
 #include "x64.hpp"
 #include "../utils.hpp"
 #include <algorithm>
+#include <array>
 #include <cstddef>
+#include <limits>
 #include <map>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace fish::java::x64::reg_alloc_detail {
     using ssa::live::InstIter;
@@ -53,17 +58,57 @@ namespace fish::java::x64::reg_alloc_detail {
         Register::r15,
     };
 
-    using RegMap = std::map<InstIter, Register, CompareInstIter>;
+    // Registers that compiled functions must preserve. All others may be
+    // changed by calls.
+    static inline std::array<Register, 5> callee_saved_registers = {
+        Register::rbx,
+        Register::r12,
+        Register::r13,
+        Register::r14,
+        Register::r15,
+    };
 
-    class RegisterAllocator {
-        public:
-        RegisterAllocator(ssa::Function& func) : m_func(func) {
-        }
+    inline bool is_callee_saved(Register reg) {
+        return std::find(
+            callee_saved_registers.begin(), callee_saved_registers.end(), reg
+        ) != callee_saved_registers.end();
+    }
 
-        void allocate() {
-            while (!step());
-        }
+    // Registers that pass the first arguments to compiled functions, in
+    // order. Any further arguments are passed on the stack. rcx is left out,
+    // as it is the scratch register.
+    static inline std::array<Register, 6> argument_registers = {
+        Register::rdi,
+        Register::rsi,
+        Register::rdx,
+        Register::r8,
+        Register::r9,
+        Register::r10,
+    };
+
+    // Number of arguments passed on the stack to a function that takes
+    // `nargs` arguments.
+    inline std::size_t stack_arguments(std::size_t nargs) {
+        const std::size_t nregs = argument_registers.size();
+        return nargs > nregs ? nargs - nregs : 0;
+    }
 
+    // Whether `inst` loads an argument passed in a register. These are all
+    // moved to their allocated registers when the function starts (see
+    // FunctionBuilder::prologue()), so they can't share registers even if
+    // one is dead by the time the next is loaded.
+    inline bool is_register_argument(const ssa::Instruction& inst) {
+        auto load = inst.get_if<ssa::LoadArgument>();
+        return load && load->index() < argument_registers.size();
+    }
+
+    using RegMap = std::map<InstIter, Register, CompareInstIter>;
+
+    /**
+     * State and helpers shared by the register allocators.
+     */
+    class BaseAllocator {
+        public:
         RegMap& regs() {
             return m_regs;
         }
@@ -72,109 +117,736 @@ namespace fish::java::x64::reg_alloc_detail {
             return m_live_var_map;
         }
 
-        private:
+        protected:
+        BaseAllocator(ssa::Function& func) : m_func(func) {
+        }
+
         ssa::Function& m_func;
         RegMap m_regs;
         LiveVarMap m_live_var_map;
 
+        // Registers that instructions should get if possible, so that
+        // arguments and return values need fewer moves.
+        RegMap m_hints;
+
+        // Instructions whose values are live across a call. These are
+        // placed in callee-saved registers when possible, so they don't
+        // have to be saved around every call.
+        InstSet m_across_calls;
+
+        // Stores that replace spilled phis. See spill().
+        InstSet m_phi_stores;
+
+        // Values that have already been spilled.
+        InstSet m_spilled;
+
+        // Whether spilling `inst` would make it need a register for less
+        // time. Loads are as short as they can be.
+        bool can_spill(InstIter inst) const {
+            return !inst->get_if<ssa::Load>() && m_spilled.count(inst) == 0;
+        }
+
+        void spill(InstIter inst);
+        void find_hints();
+        void find_across_calls(LiveVarMap& live_var_map);
+
+        // Chooses a register for `inst` among those for which `available`
+        // returns true.
+        template <typename Func>
+        std::optional<Register> choose(InstIter inst, Func&& available) const;
+
+        template <typename T>
+        InstIter insert_before_phi_stores(ssa::BasicBlock& block, T&& inst);
+    };
+
+    /**
+     * Allocates registers by coloring the interference graph. Produces
+     * good code, but takes quadratic time or worse.
+     *
+     * Copies are coalesced when that can't make the graph harder to color.
+     * Values that might not get a register are colored optimistically,
+     * and only those that really don't fit are spilled, preferring those
+     * used least often inside loops.
+     */
+    class RegisterAllocator : public BaseAllocator {
+        public:
+        RegisterAllocator(ssa::Function& func) :
+        BaseAllocator(func), m_loops(func) {
+        }
+
+        void allocate() {
+            while (!step());
+        }
+
+        private:
+        using InstMap = std::map<InstIter, InstIter, CompareInstIter>;
+        using CostMap = std::map<InstIter, double, CompareInstIter>;
+
+        ssa::Loops m_loops;
+
+        // Maps each value that was coalesced with another to the value
+        // whose register it shares.
+        InstMap m_aliases;
+
         bool step();
+        void add_argument_interference(
+            InterferenceMap& imap, const LifeMap& life
+        );
+        void add_phi_interference(
+            InterferenceMap& imap, LiveVarMap& live_var_map
+        );
+        void coalesce(InterferenceMap& imap);
+        CostMap spill_costs(
+            const InterferenceMap& imap, const LifeMap& life
+        ) const;
+
+        InstIter alias(InstIter inst) const {
+            for (auto it = m_aliases.find(inst); it != m_aliases.end();) {
+                inst = it->second;
+                it = m_aliases.find(inst);
+            }
+            return inst;
+        }
+
+        // Estimated number of times `block` runs for each time the
+        // function does.
+        double frequency(const ssa::BasicBlock& block) const {
+            double result = 1;
+            for (std::size_t i = 0; i < m_loops.depth(block); ++i) {
+                result *= 10;
+            }
+            return result;
+        }
+    };
+
+    /**
+     * Allocates registers with a linear scan over live intervals, in
+     * close to linear time. Values that don't fit in registers are
+     * spilled: they are stored after they are defined, and loaded just
+     * before each use, which splits them into short intervals.
+     */
+    class LinearScanAllocator : public BaseAllocator {
+        public:
+        LinearScanAllocator(ssa::Function& func) : BaseAllocator(func) {
+        }
+
+        void allocate() {
+            while (!step());
+        }
+
+        private:
+        // Positions, inclusive, where a value needs its register. Place
+        // number `n` reads its inputs at position `2*n` and writes its
+        // result at `2*n + 1`, so a value can reuse the register of an
+        // input that dies there.
+        struct Interval {
+            InstIter inst;
+            std::size_t start = 0;
+            std::size_t end = 0;
+        };
+
+        bool step();
+        std::vector<Interval> intervals(LifeMapBuilder& builder) const;
     };
 
     inline bool RegisterAllocator::step() {
         m_regs.clear();
+        m_aliases.clear();
         LifeMapBuilder builder(m_func);
         InterferenceMap imap(builder.life_map());
+        add_argument_interference(imap, builder.life_map());
+        add_phi_interference(imap, builder.live_var_map());
+        find_hints();
+        find_across_calls(builder.live_var_map());
+        coalesce(imap);
+        const CostMap costs = spill_costs(imap, builder.life_map());
 
+        // Removes nodes that can always be colored. When there are none,
+        // the cheapest node to spill is removed anyway, as its neighbors
+        // might still leave a register for it.
         std::list<std::pair<InstIter, InstSet>> removed;
-        bool any = false;
-        do {
-            any = false;
-            auto it = imap.begin();
-            auto end = imap.end();
+        while (!imap.empty()) {
+            auto node = std::find_if(
+                imap.begin(), imap.end(), [] (auto& pair) {
+                    return pair.second.size() < registers.size();
+                }
+            );
+            if (node == imap.end()) {
+                node = std::min_element(
+                    imap.begin(), imap.end(), [&] (auto& pair1, auto& pair2) {
+                        return (
+                            costs.at(pair1.first) / pair1.second.size() <
+                            costs.at(pair2.first) / pair2.second.size()
+                        );
+                    }
+                );
+            }
+            removed.emplace_front(node->first, std::move(node->second));
+            imap.remove(node);
+        }
+
+        std::list<InstIter> uncolored;
+        for (auto& [inst, neighbors] : removed) {
+            auto available = [&, &neighbors = neighbors] (Register reg) {
+                for (InstIter neighbor : neighbors) {
+                    auto alloc = m_regs.find(neighbor);
+                    if (alloc != m_regs.end() && alloc->second == reg) {
+                        return false;
+                    }
+                }
+                return true;
+            };
+
+            std::optional<Register> reg = choose(inst, available);
+            if (!reg) {
+                uncolored.push_back(inst);
+                continue;
+            }
+            m_regs.emplace(inst, *reg);
+        }
+
+        if (!uncolored.empty()) {
+            std::list<InstIter> spilled;
+            for (InstIter inst : uncolored) {
+                if (can_spill(inst)) {
+                    spilled.push_back(inst);
+                }
+                for (auto& [member, target] : m_aliases) {
+                    if (&*alias(member) == &*inst && can_spill(member)) {
+                        spilled.push_back(member);
+                    }
+                }
+            }
+            if (spilled.empty()) {
+                throw std::runtime_error("Can't allocate!");
+            }
+            for (InstIter inst : spilled) {
+                spill(inst);
+            }
+            return false;
+        }
+
+        for (auto& [member, target] : m_aliases) {
+            m_regs.emplace(member, m_regs.at(alias(member)));
+        }
+        m_live_var_map = std::move(builder.live_var_map());
+        return true;
+    }
+
+    // Gives the operands of moves and phis the same register when they
+    // don't interfere, so no move is needed. Two values are combined only
+    // if the result has fewer than `registers.size()` neighbors that
+    // can't always be colored (Briggs's test), so the graph stays as easy
+    // to color. Copies in loops are tried first.
+    inline void RegisterAllocator::coalesce(InterferenceMap& imap) {
+        struct Copy {
+            InstIter dest;
+            InstIter source;
+            double frequency = 0;
+        };
+
+        std::vector<Copy> copies;
+        auto add = [&] (InstIter dest, const ssa::Value& value, auto& block) {
+            if (auto ptr = value.get_if<InstIter>()) {
+                copies.push_back(Copy{dest, *ptr, frequency(block)});
+            }
+        };
+
+        for (auto& block : m_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            auto end = instructions.end();
             for (; it != end; ++it) {
-                if (it->second.size() < registers.size()) {
-                    removed.emplace_front(it->first, std::move(it->second));
-                    imap.remove(it);
-                    any = true;
-                    break;
+                if (auto move = it->get_if<ssa::Move>()) {
+                    add(it, move->value(), block);
+                } else if (auto phi = it->get_if<ssa::Phi>()) {
+                    for (auto& pair : *phi) {
+                        add(it, pair.value(), pair.block());
+                    }
                 }
             }
-        } while (any);
+        }
 
-        if (!imap.empty()) {
-            auto max = std::max_element(
-                imap.begin(), imap.end(), [] (auto& pair1, auto& pair2) {
-                    return pair1.second.size() < pair2.second.size();
+        std::stable_sort(
+            copies.begin(), copies.end(), [] (auto& copy1, auto& copy2) {
+                return copy1.frequency > copy2.frequency;
+            }
+        );
+
+        const std::size_t nregs = registers.size();
+        for (const Copy& copy : copies) {
+            InstIter into = alias(copy.dest);
+            InstIter from = alias(copy.source);
+            if (&*into == &*from) continue;
+            if (!imap.contains(into) || !imap.contains(from)) continue;
+            if (imap.interferes(into, from)) continue;
+
+            InstSet neighbors = imap.neighbors(into);
+            for (InstIter neighbor : imap.neighbors(from)) {
+                neighbors.insert(neighbor);
+            }
+            std::size_t significant = 0;
+            for (InstIter neighbor : neighbors) {
+                significant += imap.neighbors(neighbor).size() >= nregs;
+            }
+            if (significant >= nregs) continue;
+
+            // Keep the hint and the need for a callee-saved register.
+            if (m_hints.count(into) == 0 && m_hints.count(from) > 0) {
+                std::swap(into, from);
+            }
+            if (m_across_calls.count(from) > 0) {
+                m_across_calls.insert(into);
+            }
+            imap.merge(into, from);
+            m_aliases.emplace(from, into);
+        }
+    }
+
+    // Estimates how costly it would be to spill each node: the number of
+    // times its values are defined or used, with each block weighted by
+    // how often it runs. Spilling nodes that can't be spilled, or that are
+    // live at only one place (where the load would go), costs infinitely
+    // much.
+    inline RegisterAllocator::CostMap RegisterAllocator::spill_costs(
+        const InterferenceMap& imap, const LifeMap& life
+    ) const {
+        CostMap result;
+        auto add = [&] (InstIter inst, const ssa::BasicBlock& block) {
+            result[alias(inst)] += frequency(block);
+        };
+        auto add_value = [&] (const ssa::Value& value, auto& block) {
+            if (auto ptr = value.get_if<InstIter>()) {
+                add(*ptr, block);
+            }
+        };
+
+        for (auto& block : m_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            auto end = instructions.end();
+            for (; it != end; ++it) {
+                add(it, block);
+                if (auto phi = it->get_if<ssa::Phi>()) {
+                    for (auto& pair : *phi) {
+                        add_value(pair.value(), pair.block());
+                    }
+                    continue;
                 }
-            );
+                for (auto value : it->inputs()) {
+                    add_value(*value, block);
+                }
+            }
+            for (auto value : block.terminator().inputs()) {
+                add_value(*value, block);
+            }
+        }
+
+        std::map<InstIter, std::size_t, CompareInstIter> places;
+        for (auto& [inst, live_places] : life) {
+            places[alias(inst)] += live_places.size();
+        }
+
+        auto infinity = std::numeric_limits<double>::infinity();
+        for (auto& [inst, neighbors] : imap) {
+            if (!can_spill(inst) || places[inst] <= 1) {
+                result[inst] = infinity;
+            }
+        }
+        for (auto& [member, target] : m_aliases) {
+            if (!can_spill(member)) {
+                result[alias(member)] = infinity;
+            }
+        }
+        return result;
+    }
+
+    // See is_register_argument().
+    inline void RegisterAllocator::add_argument_interference(
+        InterferenceMap& imap, const LifeMap& life
+    ) {
+        std::list<InstIter> args;
+        for (auto& block : m_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            auto end = instructions.end();
+            for (; it != end; ++it) {
+                if (is_register_argument(*it) && life.count(it) > 0) {
+                    args.push_back(it);
+                }
+            }
+        }
+
+        for (auto it1 = args.begin(); it1 != args.end(); ++it1) {
+            auto it2 = it1;
+            for (++it2; it2 != args.end(); ++it2) {
+                imap.add(*it1, *it2);
+            }
+        }
+    }
+
+    // Phis are assigned at the end of each predecessor, before it
+    // branches (see FunctionBuilder::build_phi_transfers()), so a phi
+    // can't share a register with anything still live there, such as a
+    // value needed along the predecessor's other edge. Its own input from
+    // that predecessor is read as the phi is assigned.
+    inline void RegisterAllocator::add_phi_interference(
+        InterferenceMap& imap, LiveVarMap& live_var_map
+    ) {
+        for (auto& block : m_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            auto end = instructions.end();
+            for (; it != end; ++it) {
+                auto phi = it->get_if<ssa::Phi>();
+                if (!phi) break;
+                if (!imap.contains(it)) continue;
+                for (auto& pair : *phi) {
+                    auto live = live_var_map.find(
+                        &pair.block().terminator()
+                    );
+                    if (live == live_var_map.end()) continue;
+                    auto input = pair.value().get_if<InstIter>();
+                    for (InstIter other : live->second) {
+                        if (&*other == &*it) continue;
+                        if (input && &**input == &*other) continue;
+                        imap.add(it, other);
+                    }
+                }
+            }
+        }
+    }
+
+    inline bool LinearScanAllocator::step() {
+        m_regs.clear();
+        LifeMapBuilder builder(m_func);
+        find_hints();
+        find_across_calls(builder.live_var_map());
+
+        std::vector<Interval> sorted = intervals(builder);
+        std::sort(
+            sorted.begin(), sorted.end(), [] (auto& first, auto& second) {
+                return first.start < second.start;
+            }
+        );
+
+        // Intervals that hold registers, in order of increasing end.
+        std::list<Interval> active;
+        std::list<InstIter> spilled;
+
+        auto activate = [&] (const Interval& interval) {
+            auto it = active.begin();
+            for (; it != active.end(); ++it) {
+                if (it->end > interval.end) break;
+            }
+            active.insert(it, interval);
+        };
+
+        for (const Interval& current : sorted) {
+            while (!active.empty() && active.front().end < current.start) {
+                active.pop_front();
+            }
+
+            auto available = [&] (Register reg) {
+                for (const Interval& interval : active) {
+                    if (m_regs.at(interval.inst) == reg) {
+                        return false;
+                    }
+                }
+                return true;
+            };
+
+            std::optional<Register> reg = choose(current.inst, available);
+            if (reg) {
+                m_regs.emplace(current.inst, *reg);
+                activate(current);
+                continue;
+            }
+
+            // Spill whichever interval ends last.
+            auto victim = active.end();
+            for (auto it = active.begin(); it != active.end(); ++it) {
+                if (can_spill(it->inst)) {
+                    victim = it;
+                }
+            }
+
+            if (
+                can_spill(current.inst) &&
+                (victim == active.end() || victim->end <= current.end)
+            ) {
+                spilled.push_back(current.inst);
+                continue;
+            }
+            if (victim == active.end()) {
+                throw std::runtime_error("Can't allocate!");
+            }
+
+            auto victim_reg = m_regs.find(victim->inst);
+            m_regs.emplace(current.inst, victim_reg->second);
+            m_regs.erase(victim_reg);
+            spilled.push_back(victim->inst);
+            active.erase(victim);
+            activate(current);
+        }
+
+        if (!spilled.empty()) {
+            for (InstIter inst : spilled) {
+                spill(inst);
+            }
+            return false;
+        }
+
+        m_live_var_map = std::move(builder.live_var_map());
+        return true;
+    }
+
+    // Numbers every instruction and terminator in block order, and
+    // returns an interval for every value that covers each place where it
+    // is live.
+    inline std::vector<LinearScanAllocator::Interval>
+    LinearScanAllocator::intervals(LifeMapBuilder& builder) const {
+        std::unordered_map<const void*, std::size_t> places;
+        std::unordered_map<const void*, const ssa::BasicBlock*> ends;
+        for (auto& block : m_func.blocks()) {
+            for (auto& inst : block.instructions()) {
+                places.emplace(&inst, places.size());
+            }
+            places.emplace(&block.terminator(), places.size());
+            ends.emplace(&block.terminator(), &block);
+        }
+
+        // Whether `inst` is still live after the terminator of `block`,
+        // i.e., at the start of one of its successors.
+        LiveVarMap& live_var_map = builder.live_var_map();
+        auto live_out = [&] (InstIter inst, const ssa::BasicBlock& block) {
+            for (const ssa::BasicBlock* succ : block.successors()) {
+                const void* start = &succ->terminator();
+                auto insts = succ->instructions();
+                if (insts.begin() != insts.end()) {
+                    start = &*insts.begin();
+                }
+                if (live_var_map[start].count(inst) > 0) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        std::vector<Interval> result;
+        result.reserve(builder.life_map().size());
+        for (auto& [inst, live_places] : builder.life_map()) {
+            Interval interval{inst};
+            interval.start = interval.end = 2 * places.at(&*inst) + 1;
+            auto cover = [&] (std::size_t pos) {
+                interval.start = std::min(interval.start, pos);
+                interval.end = std::max(interval.end, pos);
+            };
+
+            for (const void* place : live_places) {
+                const std::size_t pos = 2 * places.at(place);
+                cover(pos);
+                auto end = ends.find(place);
+                if (end != ends.end() && live_out(inst, *end->second)) {
+                    cover(pos + 1);
+                }
+            }
+
+            // See is_register_argument().
+            if (is_register_argument(*inst)) {
+                cover(0);
+            }
+
+            // Phis are assigned at the end of each predecessor.
+            if (auto phi = inst->get_if<ssa::Phi>()) {
+                for (auto& pair : *phi) {
+                    cover(2 * places.at(&pair.block().terminator()) + 1);
+                }
+            }
+            result.push_back(interval);
+        }
+        return result;
+    }
 
-            InstIter inst = max->first;
+    // Stores the value of `inst` in a new stack slot and loads it again
+    // before each use. A phi is replaced entirely: each predecessor
+    // stores its input in the slot, so the phi needs no register.
+    inline void BaseAllocator::spill(InstIter inst) {
+        const std::size_t slot = m_func.stack_slots()++;
+        auto uses = [&] (const ssa::Use& value) {
+            auto ptr = value.get_if<InstIter>();
+            return ptr && &**ptr == &*inst;
+        };
+
+        InstIter store;
+        auto phi = inst->get_if<ssa::Phi>();
+        if (!phi) {
             InstIter next = inst;
             ++next;
+            decltype(auto) instructions = inst->block().instructions();
+            // Phis must stay at the start of their block.
+            while (next != instructions.end() && next->get_if<ssa::Phi>()) {
+                ++next;
+            }
+            store = instructions.insert(next, ssa::Store(slot, inst));
+        }
 
-            ssa::BasicBlock& block = inst->block();
-            std::size_t slot = m_func.stack_slots()++;
-            auto store = block.instructions().insert(
-                next, ssa::Store(slot, inst)
-            );
+        for (auto& block : m_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            auto end = instructions.end();
+            for (; it != end; ++it) {
+                if (!phi && it == store) continue;
 
-            for (auto& block : m_func.blocks()) {
-                decltype(auto) instructions = block.instructions();
-                auto it = instructions.begin();
-                auto end = instructions.end();
-                for (; it != end; ++it) {
-                    if (&*it == &*store) continue;
-                    for (auto value : it->inputs()) {
-                        auto ptr = value->get_if<InstIter>();
-                        if (!ptr) continue;
-                        if (&**ptr != &*inst) continue;
-                        auto load = instructions.insert(it, ssa::Load(slot));
-                        *value = ssa::Value(load);
+                // Phi inputs are needed at the end of the predecessor.
+                if (auto other = it->get_if<ssa::Phi>()) {
+                    for (auto& pair : *other) {
+                        if (!uses(pair.value())) continue;
+                        auto load = insert_before_phi_stores(
+                            pair.block(), ssa::Load(slot)
+                        );
+                        pair.value() = ssa::Value(load);
                     }
+                    continue;
                 }
 
-                for (auto value : block.terminator().inputs()) {
-                    auto ptr = value->get_if<InstIter>();
-                    if (!ptr) continue;
-                    if (&**ptr != &*inst) continue;
-                    auto load = instructions.append(ssa::Load(slot));
+                for (auto value : it->inputs()) {
+                    if (!uses(*value)) continue;
+                    auto load = instructions.insert(it, ssa::Load(slot));
                     *value = ssa::Value(load);
                 }
             }
-            return false;
+
+            for (auto value : block.terminator().inputs()) {
+                if (!uses(*value)) continue;
+                auto load = insert_before_phi_stores(block, ssa::Load(slot));
+                *value = ssa::Value(load);
+            }
         }
 
-        for (auto& [inst, neighbors] : removed) {
-            bool conflict = false;
-            for (Register reg : registers) {
-                conflict = false;
-                for (InstIter neighbor : neighbors) {
-                    auto alloc = m_regs.find(neighbor);
-                    if (alloc == m_regs.end()) {
-                        continue;
+        if (!phi) {
+            m_spilled.insert(inst);
+            return;
+        }
+        // These come after every load of a phi input, which must still
+        // see the previous values of the slots.
+        for (auto& pair : *phi) {
+            m_phi_stores.insert(pair.block().instructions().append(
+                ssa::Store(slot, pair.value())
+            ));
+        }
+        inst->block().instructions().erase(inst);
+    }
+
+    // Inserts `inst` at the end of `block`, but before the stores that
+    // replace spilled phis.
+    template <typename T>
+    InstIter
+    BaseAllocator::insert_before_phi_stores(ssa::BasicBlock& block, T&& inst) {
+        decltype(auto) instructions = block.instructions();
+        auto pos = instructions.end();
+        while (pos != instructions.begin()) {
+            auto prev = pos;
+            --prev;
+            if (m_phi_stores.count(prev) == 0) break;
+            pos = prev;
+        }
+        return instructions.insert(pos, std::forward<T>(inst));
+    }
+
+    inline void
+    BaseAllocator::find_across_calls(LiveVarMap& live_var_map) {
+        m_across_calls.clear();
+        for (auto& block : m_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            auto end = instructions.end();
+            for (; it != end; ++it) {
+                if (
+                    !it->get_if<ssa::FunctionCall>() &&
+                    !it->get_if<ssa::StandardCall>()
+                ) {
+                    continue;
+                }
+                for (InstIter live : live_var_map[ssa::live::next_place(it)]) {
+                    if (live != it) {
+                        m_across_calls.insert(live);
                     }
-                    if (alloc->second == reg) {
-                        conflict = true;
-                        break;
+                }
+            }
+        }
+    }
+
+    inline void BaseAllocator::find_hints() {
+        m_hints.clear();
+        auto hint = [&] (const ssa::Value& value, Register reg) {
+            if (auto ptr = value.get_if<InstIter>()) {
+                m_hints.emplace(*ptr, reg);
+            }
+        };
+
+        for (auto& block : m_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto it = instructions.begin();
+            auto end = instructions.end();
+            for (; it != end; ++it) {
+                if (auto load = it->get_if<ssa::LoadArgument>()) {
+                    if (load->index() < argument_registers.size()) {
+                        m_hints.emplace(
+                            it, argument_registers[load->index()]
+                        );
                     }
                 }
-                if (!conflict) {
-                    m_regs.emplace(inst, reg);
-                    break;
+                else if (auto call = it->get_if<ssa::FunctionCall>()) {
+                    m_hints.emplace(it, Register::rax);
+                    std::size_t index = 0;
+                    for (auto& arg : call->args()) {
+                        if (index >= argument_registers.size()) break;
+                        hint(arg, argument_registers[index++]);
+                    }
                 }
             }
-            if (conflict) {
-                throw std::runtime_error("Can't allocate!");
+            if (auto ret = block.terminator().get_if<ssa::Return>()) {
+                hint(ret->value(), Register::rax);
             }
         }
+    }
+
+    template <typename Func>
+    std::optional<Register>
+    BaseAllocator::choose(InstIter inst, Func&& available) const {
+        // Hints are never callee-saved registers, so they are skipped for
+        // values that are live across calls.
+        const bool across = m_across_calls.count(inst) > 0;
+        auto hint = m_hints.find(inst);
+        if (!across && hint != m_hints.end() && available(hint->second)) {
+            return hint->second;
+        }
 
-        m_live_var_map = std::move(builder.live_var_map());
-        return true;
+        auto reg = std::find_if(
+            registers.begin(), registers.end(), [&] (Register reg) {
+                return is_callee_saved(reg) == across && available(reg);
+            }
+        );
+        if (reg == registers.end()) {
+            reg = std::find_if(registers.begin(), registers.end(), available);
+        }
+        if (reg == registers.end()) {
+            return std::nullopt;
+        }
+        return *reg;
     }
 }
 
 namespace fish::java::x64 {
+    using reg_alloc_detail::registers;
+    using reg_alloc_detail::argument_registers;
+    using reg_alloc_detail::callee_saved_registers;
+    using reg_alloc_detail::is_callee_saved;
+    using reg_alloc_detail::is_register_argument;
+    using reg_alloc_detail::stack_arguments;
     using reg_alloc_detail::RegMap;
     using reg_alloc_detail::LiveVarMap;
     using reg_alloc_detail::RegisterAllocator;
+    using reg_alloc_detail::LinearScanAllocator;
 }
@@ -21,10 +21,14 @@
 #include "x64.hpp"
 #include "../typedefs.hpp"
 #include "../utils.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <stdexcept>
 #include <type_traits>
+#include <unordered_set>
 #include <variant>
+#include <vector>
 #include <utility>
 
 namespace fish::java::x64 {
@@ -36,9 +40,11 @@ namespace fish::java::x64 {
         return reg >= Register::r8;
     }
 
-    class UnlinkedRel32 {
+    // A displacement to fill in once the offset of its target instruction
+    // is known. It is relative to `base()` and written at `pos()`.
+    class UnlinkedRel {
         public:
-        UnlinkedRel32(
+        UnlinkedRel(
             const Instruction& inst, std::size_t base, std::size_t pos
         ) : m_inst(&inst), m_base(base), m_pos(pos) {
         }
@@ -68,17 +74,28 @@ namespace fish::java::x64 {
         }
 
         void assemble() {
-            for (const Function& func : m_program.functions()) {
-                assemble(func);
-            }
-            for (auto& unlinked : m_unlinked_rel32) {
-                std::size_t abs = m_inst_map.at(&unlinked.instruction());
-                std::size_t rel = abs - unlinked.base();
+            // Jumps start out short, with 8-bit displacements. Making the
+            // ones whose targets are out of range longer moves other code,
+            // so this repeats until every short jump fits.
+            do {
+                m_buf.clear();
+                m_inst_map.clear();
+                m_unlinked_rel8.clear();
+                m_unlinked_rel32.clear();
+                for (const Function& func : m_program.functions()) {
+                    assemble(func);
+                }
+            } while (lengthen_jumps());
 
+            for (auto& unlinked : m_unlinked_rel32) {
                 // NOTE: Distance cannot be larger than (2**31 - 1).
-                u32 rel32 = static_cast<u32>(rel);
+                u32 rel32 = static_cast<u32>(displacement(unlinked));
                 write32(rel32, &m_buf[unlinked.pos()]);
             }
+            for (auto& [jump, unlinked] : m_unlinked_rel8) {
+                const s64 rel8 = displacement(unlinked);
+                m_buf[unlinked.pos()] = static_cast<u8>(rel8);
+            }
         }
 
         std::size_t find(const Instruction& inst) const {
@@ -102,7 +119,11 @@ namespace fish::java::x64 {
         const Program& m_program;
         std::vector<u8> m_buf;
         std::unordered_map<const Instruction*, std::size_t> m_inst_map;
-        std::list<UnlinkedRel32> m_unlinked_rel32;
+        std::list<UnlinkedRel> m_unlinked_rel32;
+        std::list<std::pair<const Jump*, UnlinkedRel>> m_unlinked_rel8;
+
+        // Jumps that need 32-bit displacements.
+        std::unordered_set<const Jump*> m_long_jumps;
 
         void append(u8 byte) {
             m_buf.push_back(byte);
@@ -120,6 +141,37 @@ namespace fish::java::x64 {
             );
         }
 
+        void bind_rel8(const Jump& jump) {
+            m_unlinked_rel8.emplace_back(&jump, UnlinkedRel(
+                *jump.target(),
+                pos() - &m_buf[0],
+                pos() - &m_buf[0] - 1
+            ));
+        }
+
+        s64 displacement(const UnlinkedRel& unlinked) const {
+            const std::size_t abs = m_inst_map.at(&unlinked.instruction());
+            return static_cast<s64>(abs - unlinked.base());
+        }
+
+        // Marks the short jumps whose targets are out of range as long.
+        // Returns whether there were any.
+        bool lengthen_jumps() {
+            bool changed = false;
+            for (auto& [jump, unlinked] : m_unlinked_rel8) {
+                const s64 rel = displacement(unlinked);
+                if (rel < INT8_MIN || rel > INT8_MAX) {
+                    m_long_jumps.insert(jump);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        bool is_short(const Jump& jump) const {
+            return m_long_jumps.count(&jump) == 0;
+        }
+
         void bind_rel32(const Function& func) {
             auto it = func.instructions().begin();
             auto end = func.instructions().end();
@@ -190,6 +242,26 @@ namespace fish::java::x64 {
             });
         }
 
+        // Appends a single no-op of up to `size` bytes, using the forms
+        // recommended by Intel.
+        void nop(std::size_t size) {
+            static const std::vector<std::vector<u8>> nops = {
+                {0x90},
+                {0x66, 0x90},
+                {0x0f, 0x1f, 0x00},
+                {0x0f, 0x1f, 0x40, 0x00},
+                {0x0f, 0x1f, 0x44, 0x00, 0x00},
+                {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+                {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+                {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+                {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+            };
+            const auto& bytes = nops.at(std::min(size, nops.size()) - 1);
+            for (u8 byte : bytes) {
+                append(byte);
+            }
+        }
+
         void pop(const UnaryInst& inst) {
             auto reg = inst.operand().get<Register>();
             if (is_high_reg(reg)) append(0x41);
@@ -206,13 +278,17 @@ namespace fish::java::x64 {
             append(0xc0 + mod_rm(reg));
         }
 
-        void binary_prefix(const BinaryInst& inst) {
+        // 32-bit operations need a REX prefix only for high registers.
+        void binary_prefix(const BinaryInst& inst, bool wide = true) {
             auto dest = inst.dest().get<Register>();
-            u8 prefix = 0x48 | (is_high_reg(dest) ? 1 : 0);
+            u8 prefix = wide ? 0x48 : 0x40;
+            prefix |= is_high_reg(dest) ? 1 : 0;
             if (auto source = inst.source().get_if<Register>()) {
                 prefix |= is_high_reg(*source) ? 4 : 0;
             }
-            append(prefix);
+            if (prefix != 0x40) {
+                append(prefix);
+            }
         }
 
         struct BasicBinaryConfig {
@@ -220,10 +296,11 @@ namespace fish::java::x64 {
             u8 imm_opcode;
             u8 reg_base;
             u8 imm_base;
+            bool wide = true;
         };
 
         void basic_binary(const BinaryInst& inst, BasicBinaryConfig config) {
-            binary_prefix(inst);
+            binary_prefix(inst, config.wide);
             auto dest = inst.dest().get<Register>();
 
             inst.source().visit([&] (auto& obj) {
@@ -248,24 +325,58 @@ namespace fish::java::x64 {
             });
         }
 
-        // NOTE: Only supports single-byte offset.
+        // Appends the ModR/M byte and displacement for `reg` and `slot`,
+        // which is relative to rbp.
+        void stack_operand(Register reg, StackSlot slot) {
+            const s64 offset = slot.offset();
+            if (offset >= -128 && offset < 128) {
+                append(0x45 + (mod_rm(reg) << 3));
+                append(offset);
+                return;
+            }
+            append(0x85 + (mod_rm(reg) << 3));
+            imm32(offset);
+        }
+
+        // Compares a register with memory. Used for the stack check in
+        // each function's prologue.
+        void cmp(const BinaryInst& inst) {
+            auto dest = inst.dest().get<Register>();
+            auto source = inst.source().get_if<Indirect>();
+            if (!source) {
+                basic_binary(inst, {0x39, 0x81, 0xc0, 0xf8});
+                return;
+            }
+            // These would need a SIB byte or a displacement.
+            const u8 base = mod_rm(source->base());
+            if (
+                base == mod_rm(Register::rsp) ||
+                base == mod_rm(Register::rbp)
+            ) {
+                throw std::runtime_error("Unsupported operand");
+            }
+            u8 prefix = 0x48;
+            prefix |= is_high_reg(dest) ? 4 : 0;
+            prefix |= is_high_reg(source->base()) ? 1 : 0;
+            append(prefix);
+            append(0x3b);
+            append((mod_rm(dest) << 3) + base);
+        }
+
         void load(const BinaryInst& inst) {
             auto dest = inst.dest().get<Register>();
             auto source = inst.source().get<StackSlot>();
             append(0x48 | (is_high_reg(dest) ? 0x4 : 0));
             append(0x8b);
-            append(0x45 + (mod_rm(dest) << 3));
-            append(source.offset());
+            stack_operand(dest, source);
         }
 
-        // NOTE: Only supports single-byte offset.
         void store(const BinaryInst& inst) {
             auto dest = inst.dest().get<StackSlot>();
             auto source = inst.source().get<Register>();
             append(0x48 | (is_high_reg(source) ? 0x4 : 0));
             append(0x89);
-            append(0x45 + (mod_rm(source) << 3));
-            append(dest.offset());
+            stack_operand(source, dest);
         }
 
         void mov(const BinaryInst& inst) {
@@ -298,9 +409,19 @@ namespace fish::java::x64 {
             });
         }
 
+        // Unlike the other instructions, imul puts the destination in the
+        // ModRM reg field, and the source (if any) in r/m.
         void imul(const BinaryInst& inst) {
-            binary_prefix(inst);
             auto dest = inst.dest().get<Register>();
+            u8 prefix = 0x40 | (is_high_reg(dest) ? 4 : 0);
+            if (auto source = inst.source().get_if<Register>()) {
+                prefix |= is_high_reg(*source) ? 1 : 0;
+            } else {
+                prefix |= is_high_reg(dest) ? 1 : 0;
+            }
+            if (prefix != 0x40) {
+                append(prefix);
+            }
             u8 reg = 0xc0 + (mod_rm(dest) << 3);
 
             inst.source().visit([&] (auto& obj) {
@@ -321,8 +442,9 @@ namespace fish::java::x64 {
             });
         }
 
+        // The 32-bit form masks the shift count to 5 bits, as Java does.
         void shift(const BinaryInst& inst, u8 reg_mask) {
-            binary_prefix(inst);
+            binary_prefix(inst, false);
             auto dest = inst.dest().get<Register>();
             u8 reg = (0xe0 + mod_rm(dest)) | reg_mask;
 
@@ -346,6 +468,20 @@ namespace fish::java::x64 {
             });
         }
 
+        // `opcode` is the second byte of the long form.
+        void jcc(const Jump& inst, u8 opcode) {
+            if (is_short(inst)) {
+                append(opcode - 0x10);
+                append(0);
+                bind_rel8(inst);
+                return;
+            }
+            append(0x0f);
+            append(opcode);
+            imm32(0);
+            bind_rel32(*inst.target());
+        }
+
         void test8(const BinaryInst& inst) {
             auto source = inst.source().get<Register>();
             auto dest = inst.dest().get<Register>();
@@ -364,6 +500,13 @@ namespace fish::java::x64 {
                 append(0xc3);
                 break;
             }
+
+            case NullaryInst::Op::align: {
+                while (m_buf.size() % code_alignment != 0) {
+                    nop(code_alignment - m_buf.size() % code_alignment);
+                }
+                break;
+            }
         }
     }
 
@@ -424,27 +567,42 @@ namespace fish::java::x64 {
             }
 
             case BinaryInst::Op::sub: {
-                basic_binary(inst, {0x29, 0x81, 0xe8, 0xe8});
+                basic_binary(inst, {0x29, 0x81, 0xc0, 0xe8});
                 break;
             }
 
-            case BinaryInst::Op::imul: {
+            case BinaryInst::Op::add32: {
+                basic_binary(inst, {0x01, 0x81, 0xc0, 0xc0, false});
+                break;
+            }
+
+            case BinaryInst::Op::sub32: {
+                basic_binary(inst, {0x29, 0x81, 0xc0, 0xe8, false});
+                break;
+            }
+
+            case BinaryInst::Op::imul32: {
                 imul(inst);
                 break;
             }
 
-            case BinaryInst::Op::shl: {
+            case BinaryInst::Op::shl32: {
                 shift(inst, 0x00);
                 break;
             }
 
-            case BinaryInst::Op::shr: {
-                shift(inst, 0x08);
+            case BinaryInst::Op::sar32: {
+                shift(inst, 0x18);
                 break;
             }
 
             case BinaryInst::Op::cmp: {
-                basic_binary(inst, {0x39, 0x81, 0xc0, 0xf8});
+                cmp(inst);
+                break;
+            }
+
+            case BinaryInst::Op::cmp32: {
+                basic_binary(inst, {0x39, 0x81, 0xc0, 0xf8, false});
                 break;
             }
 
@@ -458,24 +616,58 @@ namespace fish::java::x64 {
     inline void Assembler::assemble(const Jump& inst) {
         switch (inst.cond()) {
             case Jump::Cond::always: {
+                if (is_short(inst)) {
+                    append(0xeb);
+                    append(0);
+                    bind_rel8(inst);
+                    break;
+                }
                 append(0xe9);
                 imm32(0);
                 bind_rel32(*inst.target());
                 break;
             }
 
-            case Jump::Cond::jz: {
-                append(0x0f);
-                append(0x84);
-                imm32(0);
-                bind_rel32(*inst.target());
+            case Jump::Cond::jz:
+            case Jump::Cond::je: {
+                jcc(inst, 0x84);
+                break;
+            }
+
+            case Jump::Cond::jne: {
+                jcc(inst, 0x85);
+                break;
+            }
+
+            case Jump::Cond::jl: {
+                jcc(inst, 0x8c);
+                break;
+            }
+
+            case Jump::Cond::jle: {
+                jcc(inst, 0x8e);
+                break;
+            }
+
+            case Jump::Cond::jg: {
+                jcc(inst, 0x8f);
+                break;
+            }
+
+            case Jump::Cond::jge: {
+                jcc(inst, 0x8d);
+                break;
+            }
+
+            case Jump::Cond::jae: {
+                jcc(inst, 0x83);
                 break;
             }
         }
     }
 
     inline void Assembler::assemble(const Call& inst) {
-        append(0xe8);
+        append(inst.tail() ? 0xe9 : 0xe8);
         imm32(0);
         bind_rel32(inst.function());
     }
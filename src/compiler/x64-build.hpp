@@ -21,19 +21,34 @@
 #include "x64.hpp"
 #include "x64-alloc.hpp"
 #include "x64-builtins.hpp"
+#include "x64-layout.hpp"
 #include "../utils.hpp"
 #include <list>
 #include <optional>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <variant>
+#include <vector>
 
 namespace fish::java::x64 {
+    enum class AllocatorKind {
+        // Graph coloring (RegisterAllocator), which produces better code.
+        coloring,
+
+        // Linear scan (LinearScanAllocator), which is much faster for large
+        // functions.
+        linear_scan,
+    };
+
     class ProgramBuilder {
         public:
-        ProgramBuilder(Program& program, ssa::Program& ssa_prog) :
-        m_program(program), m_ssa_prog(ssa_prog) {
+        ProgramBuilder(
+            Program& program, ssa::Program& ssa_prog,
+            AllocatorKind allocator = AllocatorKind::coloring
+        ) :
+        m_program(program), m_ssa_prog(ssa_prog), m_allocator(allocator) {
             for (ssa::Function& ssa_func : m_ssa_prog.functions()) {
                 auto it = m_program.functions().add(Function(ssa_func.name()));
                 Function& func = *it;
@@ -43,18 +58,20 @@ namespace fish::java::x64 {
 
         void build();
 
-        protected:
-        friend class FunctionBuilder;
-
         Function& function(const ssa::Function& ssa_func) {
             auto it = m_func_map.find(const_cast<ssa::Function*>(&ssa_func));
             assert(it != m_func_map.end());
             return *it->second;
         }
 
+        AllocatorKind allocator() const {
+            return m_allocator;
+        }
+
         private:
         Program& m_program;
         ssa::Program& m_ssa_prog;
+        AllocatorKind m_allocator = AllocatorKind::coloring;
         std::unordered_map<ssa::Function*, Function*> m_func_map;
     };
 
@@ -70,15 +87,36 @@ namespace fish::java::x64 {
         m_parent(parent),
         m_func(function),
         m_ssa_func(ssa_func) {
-            RegisterAllocator allocator(ssa_func);
-            allocator.allocate();
-            m_regs = std::move(allocator.regs());
-            m_live_var_map = std::move(allocator.live_var_map());
+            if (parent.allocator() == AllocatorKind::linear_scan) {
+                allocate<LinearScanAllocator>();
+            } else {
+                allocate<RegisterAllocator>();
+            }
+
+            for (Register reg : callee_saved_registers) {
+                for (auto& pair : m_regs) {
+                    if (pair.second == reg) {
+                        m_callee_saved.push_back(reg);
+                        break;
+                    }
+                }
+            }
+            find_fused_comparisons();
+            find_sibling_calls();
         }
 
         void build() {
-            for (ssa::BasicBlock& ssa_block : m_ssa_func.blocks()) {
-                build(ssa_block);
+            BlockLayout layout(m_ssa_func);
+            std::vector<ssa::BasicBlock*> order = layout.order();
+            for (std::size_t i = 0; i < order.size(); ++i) {
+                m_next = i + 1 < order.size() ? order[i + 1] : nullptr;
+                // Loops are entered by falling through to their first
+                // block, so the padding is skipped by the jumps back.
+                const std::size_t depth = layout.depth(*order[i]);
+                if (i > 0 && depth > layout.depth(*order[i - 1])) {
+                    append(NullaryInst(NullaryInst::Op::align));
+                }
+                build(*order[i]);
             }
             for (auto& pair : m_unlinked) {
                 auto block = pair.first;
@@ -94,23 +132,50 @@ namespace fish::java::x64 {
         RegMap m_regs;
         LiveVarMap m_live_var_map;
 
+        // Callee-saved registers used by the function, which the prologue
+        // saves.
+        std::vector<Register> m_callee_saved;
+
+        // Comparisons used only by the branch that ends their block. These
+        // set flags for a conditional jump instead of producing a value.
+        std::unordered_set<const ssa::Instruction*> m_fused;
+
+        // Calls whose result is returned right after, and whose arguments
+        // are all passed in registers. These jump to the callee after
+        // tearing down the frame, so it returns to this function's caller.
+        std::unordered_set<const ssa::Instruction*> m_sibling_calls;
+
         std::unordered_map<const ssa::BasicBlock*, InstIter> m_block_map;
         std::list<std::pair<const ssa::BasicBlock*, OptInstIter*>> m_unlinked;
 
-        const ssa::BasicBlock* m_block = nullptr;
+        // Blocks built since the last instruction was appended. A block
+        // with no code starts where the next one does.
+        std::vector<const ssa::BasicBlock*> m_pending;
+
+        // The block placed after the one being built, which it can fall
+        // through to.
+        const ssa::BasicBlock* m_next = nullptr;
         bool m_prologue_done = false;
 
         Function& function(const ssa::Function& ssa_func) {
             return m_parent.function(ssa_func);
         }
 
+        template <typename Allocator>
+        void allocate() {
+            Allocator allocator(m_ssa_func);
+            allocator.allocate();
+            m_regs = std::move(allocator.regs());
+            m_live_var_map = std::move(allocator.live_var_map());
+        }
+
         template <typename T>
         InstructionIterator append(T&& inst) {
             auto it = m_func.instructions().append(std::forward<T>(inst));
-            if (m_block) {
-                m_block_map.emplace(m_block, it);
-                m_block = nullptr;
+            for (const ssa::BasicBlock* block : m_pending) {
+                m_block_map.emplace(block, it);
             }
+            m_pending.clear();
             return it;
         }
 
@@ -144,37 +209,125 @@ namespace fish::java::x64 {
 
         u64 sspace() const {
             auto nslots = m_ssa_func.stack_slots();
-            auto nargs = m_ssa_func.nargs();
+            auto nstack = stack_arguments(m_ssa_func.nargs());
+            auto nsaved = m_callee_saved.size();
             // Ensure 16-byte stack alignment
-            return 8 * (nslots + (nslots + nargs) % 2);
+            return 8 * (nslots + (nslots + nstack + nsaved) % 2);
+        }
+
+        // Location of an argument when the function starts.
+        Operand argument(std::size_t index) const {
+            if (index < argument_registers.size()) {
+                return Operand(argument_registers[index]);
+            }
+            const std::size_t nstack = stack_arguments(m_ssa_func.nargs());
+            const std::size_t stack_index = (
+                index - argument_registers.size()
+            );
+            return Operand(StackSlot(8 * (nstack - 1 + 2 - stack_index)));
         }
 
         void prologue() {
-            append(UnaryInst(UnaryInst::Op::push, Register::rbp));
+            std::optional<InstIter> checked;
+            if (makes_calls()) {
+                checked = check_stack();
+            }
+            auto push = append(UnaryInst(UnaryInst::Op::push, Register::rbp));
+            if (checked) {
+                (*checked)->get<Jump>().target(std::nullopt) = push;
+            }
             append(BinaryInst(
                 BinaryInst::Op::mov, Register::rbp, Register::rsp
             ));
             append(BinaryInst(
                 BinaryInst::Op::sub, Register::rsp, Constant(sspace())
             ));
+            // Saved below the stack slots, which are addressed from rbp.
+            for (Register reg : m_callee_saved) {
+                append(UnaryInst(UnaryInst::Op::push, reg));
+            }
             m_prologue_done = true;
+            load_arguments();
+        }
+
+        // Whether the function calls others without tearing down its own
+        // frame first (see find_sibling_calls()), so recursion could
+        // overflow the stack.
+        bool makes_calls() const {
+            for (ssa::BasicBlock& block : m_ssa_func.blocks()) {
+                for (ssa::Instruction& inst : block.instructions()) {
+                    if (
+                        inst.get_if<ssa::FunctionCall>() &&
+                        m_sibling_calls.count(&inst) == 0
+                    ) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        // Calls fish_java_x64_stack_overflow() if the stack pointer is
+        // below fish_java_x64_stack_limit. Returns the jump that skips the
+        // call, whose target is the next instruction appended.
+        InstIter check_stack() {
+            append(BinaryInst(
+                BinaryInst::Op::mov, Register::rcx,
+                Constant((u64)(&fish_java_x64_stack_limit))
+            ));
+            append(BinaryInst(
+                BinaryInst::Op::cmp, Register::rsp, Indirect(Register::rcx)
+            ));
+            auto jump = append(Jump(Jump::Cond::jae));
+            append(BinaryInst(
+                BinaryInst::Op::mov, Register::rcx,
+                Constant((u64)(&fish_java_x64_stack_overflow))
+            ));
+            append(RegisterCall(Register::rcx));
+            return jump;
+        }
+
+        // Moves every argument passed in a register to the register
+        // allocated for it. These may overlap, so this is done all at once
+        // rather than at each LoadArgument instruction.
+        void load_arguments() {
+            std::list<std::pair<Register, Operand>> moves;
+            for (ssa::BasicBlock& block : m_ssa_func.blocks()) {
+                decltype(auto) instructions = block.instructions();
+                auto it = instructions.begin();
+                auto end = instructions.end();
+                for (; it != end; ++it) {
+                    if (!is_register_argument(*it)) continue;
+                    std::optional<Register> reg = reg_opt(it);
+                    if (!reg) continue;
+                    auto& load = it->get<ssa::LoadArgument>();
+                    moves.emplace_back(*reg, argument(load.index()));
+                }
+            }
+            build_parallel_moves(std::move(moves));
         }
 
         void epilogue() {
+            auto it = m_callee_saved.rbegin();
+            for (; it != m_callee_saved.rend(); ++it) {
+                append(UnaryInst(UnaryInst::Op::pop, *it));
+            }
             append(BinaryInst(
                 BinaryInst::Op::add, Register::rsp, Constant(sspace())
             ));
             append(UnaryInst(UnaryInst::Op::pop, Register::rbp));
         }
 
+        // Saves the caller-saved registers that are live after `inst`.
         auto save_registers(ssa::InstructionIterator inst) {
             std::optional<Register> reg = reg_opt(inst);
             std::list<Register> saved;
-            auto ptr = static_cast<const void*>(&*inst);
 
+            const void* ptr = ssa::live::next_place(inst);
             for (auto live : m_live_var_map[ptr]) {
                 std::optional<Register> live_reg = reg_opt(live);
                 if (!live_reg) continue;
+                if (is_callee_saved(*live_reg)) continue;
                 if (reg && *reg == *live_reg) continue;
                 saved.push_front(*live_reg);
                 append(UnaryInst(UnaryInst::Op::push, *live_reg));
@@ -201,12 +354,21 @@ namespace fish::java::x64 {
             }
         }
 
+        void find_fused_comparisons();
+        const ssa::Comparison* fused_comparison(const ssa::Branch& branch);
+        void find_sibling_calls();
+        bool ends_with_sibling_call(ssa::BasicBlock& ssa_block) const;
         Operand operand(const ssa::Value& ssa_value) const;
         void build(ssa::BasicBlock& ssa_block);
         void build(ssa::InstructionIterator& ssa_inst);
         void build_block_end(ssa::BasicBlock& ssa_block);
+        void build_jump(Jump::Cond cond, const ssa::BasicBlock& target);
         void build_shift(const ssa::BinaryOperation& inst, Register dest);
+        void build_compare(const ssa::Comparison& inst, Register scratch);
         void build_phi_transfers(ssa::BasicBlock& ssa_block);
+        void build_parallel_moves(
+            std::list<std::pair<Register, Operand>> moves
+        );
     };
 
     inline void ProgramBuilder::build() {
@@ -218,6 +380,102 @@ namespace fish::java::x64 {
         }
     }
 
+    inline Jump::Cond jump_cond(ssa::Comparison::Op op) {
+        switch (op) {
+            case ssa::Comparison::Op::eq: {
+                return Jump::Cond::je;
+            }
+            case ssa::Comparison::Op::ne: {
+                return Jump::Cond::jne;
+            }
+            case ssa::Comparison::Op::lt: {
+                return Jump::Cond::jl;
+            }
+            case ssa::Comparison::Op::le: {
+                return Jump::Cond::jle;
+            }
+            case ssa::Comparison::Op::gt: {
+                return Jump::Cond::jg;
+            }
+            case ssa::Comparison::Op::ge: {
+                return Jump::Cond::jge;
+            }
+        }
+        throw std::runtime_error("Invalid comparison operator");
+    }
+
+    inline void FunctionBuilder::find_fused_comparisons() {
+        // The comparison must be the last instruction, as registers used
+        // by its operands may be reused after their last use.
+        for (ssa::BasicBlock& block : m_ssa_func.blocks()) {
+            auto branch = block.terminator().get_if<ssa::Branch>();
+            if (!branch) continue;
+            auto cond = branch->cond().get_if<ssa::InstructionIterator>();
+            if (!cond || !(*cond)->get_if<ssa::Comparison>()) continue;
+            if ((*cond)->uses().size() != 1) continue;
+            decltype(auto) instructions = block.instructions();
+            auto last = instructions.end();
+            if (last == instructions.begin() || &*--last != &**cond) {
+                continue;
+            }
+            m_fused.insert(&**cond);
+        }
+    }
+
+    inline const ssa::Comparison*
+    FunctionBuilder::fused_comparison(const ssa::Branch& branch) {
+        auto cond = branch.cond().get_if<ssa::InstructionIterator>();
+        if (!cond || m_fused.count(&**cond) == 0) {
+            return nullptr;
+        }
+        return (*cond)->get_if<ssa::Comparison>();
+    }
+
+    inline void FunctionBuilder::find_sibling_calls() {
+        // The callee expects the stack as it is after a call with no stack
+        // arguments. After the epilogue, it is as this function's caller
+        // left it, which differs in alignment if this function has an odd
+        // number of stack arguments.
+        if (stack_arguments(m_ssa_func.nargs()) % 2 != 0) {
+            return;
+        }
+        for (ssa::BasicBlock& block : m_ssa_func.blocks()) {
+            decltype(auto) instructions = block.instructions();
+            auto last = instructions.end();
+            if (last == instructions.begin()) continue;
+            --last;
+            auto call = last->get_if<ssa::FunctionCall>();
+            if (!call) continue;
+            if (stack_arguments(call->args().size()) > 0) continue;
+
+            bool returned = block.terminator().visit([&] (auto& term) {
+                using T = std::decay_t<decltype(term)>;
+                if constexpr (std::is_same_v<T, ssa::Return>) {
+                    auto value = term.value().template get_if<
+                        ssa::InstructionIterator
+                    >();
+                    return value && &**value == &*last;
+                }
+                else {
+                    return std::is_same_v<T, ssa::ReturnVoid>;
+                }
+            });
+            if (returned) {
+                m_sibling_calls.insert(&*last);
+            }
+        }
+    }
+
+    inline bool
+    FunctionBuilder::ends_with_sibling_call(ssa::BasicBlock& ssa_block) const {
+        decltype(auto) instructions = ssa_block.instructions();
+        auto last = instructions.end();
+        if (last == instructions.begin()) {
+            return false;
+        }
+        return m_sibling_calls.count(&*--last) > 0;
+    }
+
     inline Operand
     FunctionBuilder::operand(const ssa::Value& ssa_value) const {
         return ssa_value.visit([&] (auto& obj) -> Operand {
@@ -242,7 +500,7 @@ namespace fish::java::x64 {
     }
 
     inline void FunctionBuilder::build(ssa::BasicBlock& ssa_block) {
-        m_block = &ssa_block;
+        m_pending.push_back(&ssa_block);
         decltype(auto) instructions = ssa_block.instructions();
         auto it = instructions.begin();
         auto end = instructions.end();
@@ -260,9 +518,11 @@ namespace fish::java::x64 {
 
             if constexpr (std::is_same_v<T, ssa::Move>) {
                 if (!dest) return;
-                append(BinaryInst(
-                    BinaryInst::Op::mov, *dest, operand(obj.value())
-                ));
+                auto source = operand(obj.value());
+                // Coalesced moves need no code.
+                auto source_reg = source.template get_if<Register>();
+                if (source_reg && *source_reg == *dest) return;
+                append(BinaryInst(BinaryInst::Op::mov, *dest, source));
             }
 
             else if constexpr (std::is_same_v<T, ssa::BinaryOperation>) {
@@ -288,21 +548,27 @@ namespace fish::java::x64 {
                 // Move LHS to dest if needed.
                 auto left = operand(obj.left());
                 auto left_reg = left.template get_if<Register>();
-                if (left_reg && *left_reg != *dest) {
+                if (!left_reg || *left_reg != *dest) {
                     append(BinaryInst(BinaryInst::Op::mov, *dest, left));
                 }
 
                 switch (obj.op()) {
                     case ssa::BinaryOperation::Op::add: {
-                        append(BinaryInst(BinaryInst::Op::add, *dest, right));
+                        append(BinaryInst(
+                            BinaryInst::Op::add32, *dest, right
+                        ));
                         break;
                     }
                     case ssa::BinaryOperation::Op::sub: {
-                        append(BinaryInst(BinaryInst::Op::sub, *dest, right));
+                        append(BinaryInst(
+                            BinaryInst::Op::sub32, *dest, right
+                        ));
                         break;
                     }
                     case ssa::BinaryOperation::Op::mul: {
-                        append(BinaryInst(BinaryInst::Op::imul, *dest, right));
+                        append(BinaryInst(
+                            BinaryInst::Op::imul32, *dest, right
+                        ));
                         break;
                     }
                     default:;
@@ -310,19 +576,9 @@ namespace fish::java::x64 {
             }
 
             else if constexpr (std::is_same_v<T, ssa::Comparison>) {
-                if (!dest) return;
-
-                // Move LHS to dest if needed.
-                auto left = operand(obj.left());
-                auto left_reg = left.template get_if<Register>();
-                if (!left_reg) {
-                    append(BinaryInst(BinaryInst::Op::mov, *dest, left));
-                    left = Operand(*dest);
-                }
-
-                append(BinaryInst(
-                    BinaryInst::Op::cmp, left, operand(obj.right())
-                ));
+                if (!dest || m_fused.count(&*ssa_inst) > 0) return;
+                // `dest` may share a register with the right operand.
+                build_compare(obj, Register::rcx);
 
                 switch (obj.op()) {
                     case ssa::Comparison::Op::eq: {
@@ -358,15 +614,47 @@ namespace fish::java::x64 {
             }
 
             else if constexpr (std::is_same_v<T, ssa::FunctionCall>) {
+                if (m_sibling_calls.count(&*ssa_inst) > 0) {
+                    // Nothing is live afterward, so no registers are
+                    // saved, and the callee's result is already in rax.
+                    std::list<std::pair<Register, Operand>> moves;
+                    std::size_t index = 0;
+                    for (auto& arg : obj.args()) {
+                        moves.emplace_back(
+                            argument_registers[index++], operand(arg)
+                        );
+                    }
+                    build_parallel_moves(std::move(moves));
+                    epilogue();
+                    append(Call(function(obj.function()), true));
+                    return;
+                }
+
                 auto saved = save_registers(ssa_inst);
+                std::list<std::pair<Register, Operand>> moves;
+                std::size_t index = 0;
                 for (auto& arg : obj.args()) {
-                    append(UnaryInst(UnaryInst::Op::push, operand(arg)));
+                    if (index < argument_registers.size()) {
+                        moves.emplace_back(
+                            argument_registers[index], operand(arg)
+                        );
+                    } else {
+                        append(UnaryInst(UnaryInst::Op::push, operand(arg)));
+                    }
+                    ++index;
                 }
+
+                // Stack arguments are pushed first, as the moves may
+                // overwrite their registers.
+                build_parallel_moves(std::move(moves));
                 append(Call(function(obj.function())));
-                append(BinaryInst(
-                    BinaryInst::Op::add, Register::rsp,
-                    Constant(obj.args().size() * 8)
-                ));
+                const std::size_t nstack = stack_arguments(index);
+                if (nstack > 0) {
+                    append(BinaryInst(
+                        BinaryInst::Op::add, Register::rsp,
+                        Constant(nstack * 8)
+                    ));
+                }
                 if (obj.function().nreturn() > 0 && dest) {
                     append(BinaryInst(
                         BinaryInst::Op::mov, *dest, Register::rax
@@ -426,18 +714,26 @@ namespace fish::java::x64 {
             }
 
             else if constexpr (std::is_same_v<T, ssa::Store>) {
+                // Spilled phis can store constants.
+                auto source = operand(obj.value());
+                if (!source.template get_if<Register>()) {
+                    append(BinaryInst(
+                        BinaryInst::Op::mov, Register::rcx, source
+                    ));
+                    source = Operand(Register::rcx);
+                }
                 append(BinaryInst(
                     BinaryInst::Op::mov,
                     StackSlot(8 * (-static_cast<s64>(obj.index()) - 1)),
-                    operand(obj.value())
+                    source
                 ));
             }
 
             else if constexpr (std::is_same_v<T, ssa::LoadArgument>) {
-                if (!dest) return;
+                // Register arguments are loaded by the prologue.
+                if (!dest || is_register_argument(*ssa_inst)) return;
                 append(BinaryInst(
-                    BinaryInst::Op::mov, *dest,
-                    StackSlot(8 * (m_ssa_func.nargs() - 1 + 2 - obj.index()))
+                    BinaryInst::Op::mov, *dest, argument(obj.index())
                 ));
             }
 
@@ -454,12 +750,25 @@ namespace fish::java::x64 {
 
             if constexpr (std::is_same_v<T, ssa::UnconditionalBranch>) {
                 build_phi_transfers(ssa_block);
-                auto it = append(Jump());
-                auto& jump = it->get<Jump>();
-                bind(jump.target(std::nullopt), obj.target());
+                build_jump(Jump::Cond::always, obj.target());
             }
 
             else if constexpr (std::is_same_v<T, ssa::Branch>) {
+                if (auto cmp = fused_comparison(obj)) {
+                    build_compare(*cmp, Register::rcx);
+
+                    // Phi transfers only move, push, and pop, so they
+                    // preserve the flags set by the comparison.
+                    build_phi_transfers(ssa_block);
+                    if (&obj.yes() == m_next) {
+                        build_jump(jump_cond(negated(cmp->op())), obj.no());
+                        return;
+                    }
+                    build_jump(jump_cond(cmp->op()), obj.yes());
+                    build_jump(Jump::Cond::always, obj.no());
+                    return;
+                }
+
                 auto oper = operand(obj.cond());
                 append(BinaryInst(BinaryInst::Op::mov, Register::rcx, oper));
 
@@ -468,21 +777,22 @@ namespace fish::java::x64 {
                     BinaryInst::Op::test8, Register::rcx, Register::rcx
                 ));
 
-                auto it1 = append(Jump(Jump::Cond::jz));
-                auto& jump1 = it1->get<Jump>();
-                bind(jump1.target(std::nullopt), obj.no());
-
-                auto it2 = append(Jump());
-                auto& jump2 = it2->get<Jump>();
-                bind(jump2.target(std::nullopt), obj.yes());
+                if (&obj.no() == m_next) {
+                    build_jump(Jump::Cond::jne, obj.yes());
+                    return;
+                }
+                build_jump(Jump::Cond::jz, obj.no());
+                build_jump(Jump::Cond::always, obj.yes());
             }
 
             else if constexpr (std::is_same_v<T, ssa::ReturnVoid>) {
+                if (ends_with_sibling_call(ssa_block)) return;
                 epilogue();
                 append(NullaryInst(NullaryInst::Op::ret));
             }
 
             else if constexpr (std::is_same_v<T, ssa::Return>) {
+                if (ends_with_sibling_call(ssa_block)) return;
                 append(BinaryInst(
                     BinaryInst::Op::mov, Register::rax, operand(obj.value())
                 ));
@@ -496,6 +806,18 @@ namespace fish::java::x64 {
         });
     }
 
+    // Jumps to `target`, unless it comes next and the jump is
+    // unconditional.
+    inline void FunctionBuilder::
+    build_jump(Jump::Cond cond, const ssa::BasicBlock& target) {
+        if (cond == Jump::Cond::always && &target == m_next) {
+            return;
+        }
+        auto it = append(Jump(cond));
+        auto& jump = it->get<Jump>();
+        bind(jump.target(std::nullopt), target);
+    }
+
     inline void FunctionBuilder::
     build_shift(const ssa::BinaryOperation& inst, Register dest) {
         auto right = operand(inst.right());
@@ -507,33 +829,96 @@ namespace fish::java::x64 {
         // Move LHS to dest if needed.
         auto left = operand(inst.left());
         auto left_reg = left.get_if<Register>();
-        if (left_reg && *left_reg != dest) {
+        if (!left_reg || *left_reg != dest) {
             append(BinaryInst(BinaryInst::Op::mov, dest, left));
         }
 
         switch (inst.op()) {
             case ssa::BinaryOperation::Op::shl: {
-                append(BinaryInst(BinaryInst::Op::shl, dest, right));
+                append(BinaryInst(BinaryInst::Op::shl32, dest, right));
                 break;
             }
             case ssa::BinaryOperation::Op::shr: {
-                append(BinaryInst(BinaryInst::Op::shr, dest, right));
+                append(BinaryInst(BinaryInst::Op::sar32, dest, right));
                 break;
             }
             default:;
         }
     }
 
+    // Compares the operands of `inst`, using `scratch` if the left operand
+    // isn't in a register.
+    inline void FunctionBuilder::
+    build_compare(const ssa::Comparison& inst, Register scratch) {
+        auto left = operand(inst.left());
+        if (!left.get_if<Register>()) {
+            append(BinaryInst(BinaryInst::Op::mov, scratch, left));
+            left = Operand(scratch);
+        }
+        append(BinaryInst(
+            BinaryInst::Op::cmp32, left, operand(inst.right())
+        ));
+    }
+
     inline void FunctionBuilder::
     build_phi_transfers(ssa::BasicBlock& ssa_block) {
+        // All phis are assigned at once.
+        std::list<std::pair<Register, Operand>> moves;
         for (ssa::BasicBlock* succ : ssa_block.successors()) {
             for (auto& [phi, input] : succ->phis(ssa_block)) {
-                if (std::optional<Register> reg = reg_opt(phi)) {
-                    append(BinaryInst(
-                        BinaryInst::Op::mov, *reg, operand(*input)
-                    ));
+                std::optional<Register> reg = reg_opt(phi);
+                if (!reg) continue;
+                moves.emplace_back(*reg, operand(*input));
+            }
+        }
+
+        build_parallel_moves(std::move(moves));
+    }
+
+    // Performs moves as if they all happened at once, so a move never
+    // overwrites a register that another move has yet to read.
+    inline void FunctionBuilder::
+    build_parallel_moves(std::list<std::pair<Register, Operand>> moves) {
+        moves.remove_if([] (auto& move) {
+            auto source_reg = move.second.template get_if<Register>();
+            return source_reg && *source_reg == move.first;
+        });
+
+        auto is_read = [&] (Register reg) {
+            for (auto& [dest, source] : moves) {
+                auto source_reg = source.get_if<Register>();
+                if (source_reg && *source_reg == reg) {
+                    return true;
                 }
             }
+            return false;
+        };
+
+        // Registers to pop saved sources into, in reverse order. rcx
+        // can't be used as a temporary, as it may hold the branch
+        // condition.
+        std::list<Register> saved;
+        while (!moves.empty()) {
+            auto it = moves.begin();
+            for (; it != moves.end(); ++it) {
+                if (!is_read(it->first)) break;
+            }
+            if (it != moves.end()) {
+                append(BinaryInst(BinaryInst::Op::mov, it->first, it->second));
+                moves.erase(it);
+                continue;
+            }
+
+            // Every remaining move is part of a cycle. Breaking one move
+            // out of its cycle lets the others proceed.
+            it = moves.begin();
+            append(UnaryInst(UnaryInst::Op::push, it->second));
+            saved.push_front(it->first);
+            moves.erase(it);
+        }
+
+        for (Register reg : saved) {
+            append(UnaryInst(UnaryInst::Op::pop, reg));
         }
     }
 }
@@ -17,10 +17,32 @@
  * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#pragma once
+#include "../typedefs.hpp"
+
 extern "C" {
     void fish_java_x64_print_char();
     void fish_java_x64_print_int();
     void fish_java_x64_println_void();
     void fish_java_x64_println_char();
     void fish_java_x64_println_int();
+
+    // Called by compiled code when the stack is about to overflow.
+    void fish_java_x64_stack_overflow();
+
+    // Compiled code calls fish_java_x64_stack_overflow() when the stack
+    // pointer is below this on entry.
+    extern fish::java::u64 fish_java_x64_stack_limit;
+
+    // Calls the compiled function at `entry` with `nargs` arguments, letting
+    // it use `stack_size` bytes of stack. If that runs out, every compiled
+    // frame is discarded, fish_java_stack_overflow() is called, and this
+    // returns at once.
+    fish::java::u64 fish_java_x64_enter(
+        const void* entry, const fish::java::u32* args, fish::java::u64 nargs,
+        fish::java::u64 stack_size
+    );
+
+    // Defined by the runtime; see fish_java_x64_enter().
+    void fish_java_stack_overflow();
 }
@@ -17,21 +17,37 @@
  * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
  */
 
-.globl printf
 .globl fish_java_x64_print_char
 .globl fish_java_x64_print_int
 .globl fish_java_x64_println_void
 .globl fish_java_x64_println_char
 .globl fish_java_x64_println_int
+.globl fish_java_x64_enter
+.globl fish_java_x64_stack_overflow
+.globl fish_java_x64_stack_limit
 
+# Lowest address compiled code may move the stack pointer below before
+# calling another function. Set by fish_java_x64_enter.
+.data
+.balign 8
+fish_java_x64_stack_limit:
+    .quad 0
+
+# Stack pointer to return to from fish_java_x64_stack_overflow.
+enter_unwind_rsp:
+    .quad 0
+
+# Compiled code passes arguments on the stack, with the stack 16-byte aligned
+# before they are pushed. These sign-extend the argument, if any, into %rdi
+# (only the lower 32 bits of compiled values are defined) and realign the
+# stack for the C functions in output-buffer.cpp.
 .text
 fish_java_x64_print_char:
     push %rbp
     mov %rsp, %rbp
     sub $0x8, %rsp
-    lea fmt_string_char(%rip), %rdi
-    mov 16(%rbp), %rsi
-    call printf
+    movslq 16(%rbp), %rdi
+    call fish_java_print_char
     add $0x8, %rsp
     pop %rbp
     ret
@@ -40,21 +56,17 @@ fish_java_x64_print_int:
     push %rbp
     mov %rsp, %rbp
     sub $0x8, %rsp
-    lea fmt_string_int(%rip), %rdi
-    mov 16(%rbp), %rsi
-    call printf
+    movslq 16(%rbp), %rdi
+    call fish_java_print_int
     add $0x8, %rsp
     pop %rbp
     ret
 
+# Takes no arguments, so the stack is already aligned after pushing %rbp.
 fish_java_x64_println_void:
     push %rbp
     mov %rsp, %rbp
-    sub $0x8, %rsp
-    lea fmt_string_nl(%rip), %rdi
-    mov 16(%rbp), %rsi
-    call printf
-    add $0x8, %rsp
+    call fish_java_println_void
     pop %rbp
     ret
 
@@ -62,9 +74,8 @@ fish_java_x64_println_char:
     push %rbp
     mov %rsp, %rbp
     sub $0x8, %rsp
-    lea fmt_string_char_nl(%rip), %rdi
-    mov 16(%rbp), %rsi
-    call printf
+    movslq 16(%rbp), %rdi
+    call fish_java_println_char
     add $0x8, %rsp
     pop %rbp
     ret
@@ -73,25 +84,87 @@ fish_java_x64_println_int:
     push %rbp
     mov %rsp, %rbp
     sub $0x8, %rsp
-    lea fmt_string_int_nl(%rip), %rdi
-    mov 16(%rbp), %rsi
-    call printf
+    movslq 16(%rbp), %rdi
+    call fish_java_println_int
     add $0x8, %rsp
     pop %rbp
     ret
 
-.data
-fmt_string_char:
-    .string "%c"
-
-fmt_string_int:
-    .string "%ld"
-
-fmt_string_nl:
-    .string "\n"
-
-fmt_string_char_nl:
-    .string "%c\n"
+# Calls compiled code from C++. Arguments:
+#   %rdi: entry point of the compiled function
+#   %rsi: pointer to the 32-bit arguments
+#   %rdx: number of arguments
+#   %rcx: number of bytes of stack compiled code may use
+# The first six arguments are passed in %rdi, %rsi, %rdx, %r8, %r9, and %r10
+# (see x64-alloc.hpp); the rest are pushed in order. Compiled code preserves
+# the same callee-saved registers as C code, but they are saved here too, as
+# fish_java_x64_stack_overflow returns from here without restoring them.
+# The previous limit and unwind point are saved, so calls can nest.
+fish_java_x64_enter:
+    push %rbp
+    mov %rsp, %rbp
+    push %rbx
+    push %r12
+    push %r13
+    push %r14
+    push %r15
+    push fish_java_x64_stack_limit(%rip)
+    push enter_unwind_rsp(%rip)
+    sub $0x8, %rsp
+    mov %rsp, enter_unwind_rsp(%rip)
+    mov %rsp, %r11
+    sub %rcx, %r11
+    mov %r11, fish_java_x64_stack_limit(%rip)
+    mov %rdi, %rax
+    mov %rsi, %r11
+    mov %rdx, %rcx
+    mov $6, %rdx
+enter_push_args:
+    cmp %rcx, %rdx
+    jae enter_load_args
+    movslq (%r11,%rdx,4), %rdi
+    push %rdi
+    inc %rdx
+    jmp enter_push_args
+enter_load_args:
+    cmp $1, %rcx
+    jb enter_call
+    movslq (%r11), %rdi
+    cmp $2, %rcx
+    jb enter_call
+    movslq 4(%r11), %rsi
+    cmp $3, %rcx
+    jb enter_call
+    movslq 8(%r11), %rdx
+    cmp $4, %rcx
+    jb enter_call
+    movslq 12(%r11), %r8
+    cmp $5, %rcx
+    jb enter_call
+    movslq 16(%r11), %r9
+    cmp $6, %rcx
+    jb enter_call
+    movslq 20(%r11), %r10
+enter_call:
+    call *%rax
+enter_return:
+    mov enter_unwind_rsp(%rip), %rsp
+    add $0x8, %rsp
+    pop enter_unwind_rsp(%rip)
+    pop fish_java_x64_stack_limit(%rip)
+    pop %r15
+    pop %r14
+    pop %r13
+    pop %r12
+    pop %rbx
+    pop %rbp
+    ret
 
-fmt_string_int_nl:
-    .string "%ld\n"
+# Called by compiled code whose stack pointer is below
+# fish_java_x64_stack_limit. Discards every compiled frame, lets
+# fish_java_stack_overflow() report the error, and returns from
+# fish_java_x64_enter.
+fish_java_x64_stack_overflow:
+    mov enter_unwind_rsp(%rip), %rsp
+    call fish_java_stack_overflow
+    jmp enter_return
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "ssa.hpp"
+#include "ssa-loops.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace fish::java::x64 {
+    /**
+     * Orders the blocks of a function so that each block tends to be
+     * followed by its more likely successor, which then needs no jump.
+     *
+     * Edges are weighted with static estimates, as the interpreter
+     * doesn't count how often each branch is taken: blocks run more often
+     * the more loops they're in, and branches are assumed to stay in
+     * loops and to avoid returning. As in Pettis and Hansen's algorithm,
+     * blocks are joined into chains along the heaviest edges first, and
+     * the chains are placed starting with the entry block's, each one
+     * after the placed chain with the heaviest edge to it.
+     */
+    class BlockLayout {
+        using Block = ssa::BasicBlock;
+
+        public:
+        BlockLayout(ssa::Function& func) : m_loops(func) {
+            for (Block& block : func.blocks()) {
+                m_indices.emplace(&block, m_blocks.size());
+                m_blocks.push_back(&block);
+            }
+            m_out.resize(m_blocks.size());
+            for (Block* block : m_blocks) {
+                for (Block* succ : block->successors()) {
+                    m_out[index(*block)].push_back(m_edges.size());
+                    m_edges.push_back(Edge{
+                        index(*block), index(*succ), weight(*block, *succ)
+                    });
+                }
+            }
+        }
+
+        std::vector<Block*> order() const {
+            if (m_blocks.empty()) {
+                return {};
+            }
+            std::vector<std::vector<std::size_t>> chains = this->chains();
+            std::vector<std::size_t> chain_of(m_blocks.size());
+            for (std::size_t c = 0; c < chains.size(); ++c) {
+                for (std::size_t block : chains[c]) {
+                    chain_of[block] = c;
+                }
+            }
+
+            // The heaviest edge from a placed block into each chain.
+            std::vector<double> pull(chains.size(), -1);
+            std::vector<bool> placed(chains.size());
+            std::vector<Block*> result;
+            std::size_t next = chain_of[0];
+            while (true) {
+                placed[next] = true;
+                for (std::size_t block : chains[next]) {
+                    result.push_back(m_blocks[block]);
+                    for (std::size_t e : m_out[block]) {
+                        const Edge& edge = m_edges[e];
+                        double& p = pull[chain_of[edge.to]];
+                        p = std::max(p, edge.weight);
+                    }
+                }
+
+                // Chains with no edge from placed blocks keep their
+                // original order.
+                bool found = false;
+                for (std::size_t c = 0; c < chains.size(); ++c) {
+                    if (placed[c] || chains[c].empty()) continue;
+                    if (!found || pull[c] > pull[next]) {
+                        next = c;
+                        found = true;
+                    }
+                }
+                if (!found) {
+                    break;
+                }
+            }
+            return result;
+        }
+
+        // The number of loops that contain `block`.
+        std::size_t depth(const Block& block) const {
+            return m_loops.depth(block);
+        }
+
+        private:
+        struct Edge {
+            std::size_t from = 0;
+            std::size_t to = 0;
+            double weight = 0;
+        };
+
+        // How many times more often code in a loop is assumed to run
+        // than the code around the loop.
+        static constexpr double loop_frequency = 8;
+
+        // Estimated probability of a branch's more likely side.
+        static constexpr double likely = 0.8;
+
+        ssa::Loops m_loops;
+        std::vector<Block*> m_blocks;
+        std::unordered_map<Block*, std::size_t> m_indices;
+        std::vector<Edge> m_edges;
+
+        // The edges from each block, as indices into `m_edges`.
+        std::vector<std::vector<std::size_t>> m_out;
+
+        std::size_t index(Block& block) const {
+            return m_indices.at(&block);
+        }
+
+        double weight(Block& from, Block& to) const {
+            double frequency = 1;
+            for (std::size_t i = 0; i < m_loops.depth(from); ++i) {
+                frequency *= loop_frequency;
+            }
+            if (from.successors().size() == 1) {
+                return frequency;
+            }
+
+            Block* other = nullptr;
+            for (Block* succ : from.successors()) {
+                if (succ != &to) {
+                    other = succ;
+                }
+            }
+            const int a = score(from, to);
+            const int b = score(from, *other);
+            if (a == b) {
+                return frequency / 2;
+            }
+            return frequency * (a > b ? likely : 1 - likely);
+        }
+
+        // Higher for more likely successors.
+        int score(Block& from, Block& to) const {
+            int result = 0;
+            if (m_loops.depth(to) < m_loops.depth(from)) {
+                // Leaves a loop.
+                result -= 2;
+            }
+            else {
+                auto body = m_loops.bodies().find(&to);
+                if (body != m_loops.bodies().end()) {
+                    if (body->second.count(&from) > 0) {
+                        // Back edge.
+                        result += 2;
+                    }
+                }
+            }
+            if (to.successors().empty()) {
+                result -= 1;
+            }
+            return result;
+        }
+
+        // Joins blocks into chains along the heaviest edges first. An edge
+        // joins two chains if it goes from the end of one to the start of
+        // the other. Each chain is stored at the index of its first block.
+        std::vector<std::vector<std::size_t>> chains() const {
+            std::vector<std::vector<std::size_t>> result(m_blocks.size());
+            std::vector<std::size_t> chain_of(m_blocks.size());
+            for (std::size_t i = 0; i < m_blocks.size(); ++i) {
+                result[i].push_back(i);
+                chain_of[i] = i;
+            }
+
+            std::vector<Edge> edges = m_edges;
+            std::stable_sort(
+                edges.begin(), edges.end(), [] (auto& a, auto& b) {
+                    return a.weight > b.weight;
+                }
+            );
+            for (const Edge& edge : edges) {
+                // The entry block must come first.
+                if (edge.to == 0) continue;
+                std::vector<std::size_t>& from = result[chain_of[edge.from]];
+                std::vector<std::size_t>& to = result[chain_of[edge.to]];
+                if (&from == &to) continue;
+                if (from.back() != edge.from || to.front() != edge.to) {
+                    continue;
+                }
+                for (std::size_t block : to) {
+                    chain_of[block] = chain_of[edge.from];
+                }
+                from.insert(from.end(), to.begin(), to.end());
+                to.clear();
+            }
+            return result;
+        }
+    };
+}
@@ -18,6 +18,7 @@
  */
 
 #pragma once
+#include "arena.hpp"
 #include "../typedefs.hpp"
 #include "../utils.hpp"
 #include <cassert>
@@ -32,13 +33,19 @@ namespace fish::java::x64 {
     class Instruction;
     class Function;
 
-    using InstructionList = std::list<Instruction>;
+    using InstructionList = ArenaList<Instruction>;
     using InstructionIterator = InstructionList::iterator;
     using ConstInstructionIterator = InstructionList::const_iterator;
 
     using ssa::Constant;
     using ssa::ArithmeticOperator;
 
+    // Alignment of the start of each loop, in bytes, so that small loops
+    // span as few instruction fetch blocks as possible. Code is copied to
+    // page-aligned memory, so offsets in the assembled code keep their
+    // alignment.
+    constexpr std::size_t code_alignment = 32;
+
     class NullaryInst;
     class UnaryInst;
     class BinaryInst;
@@ -77,6 +84,21 @@ namespace fish::java::x64 {
         private:
         s64 m_offset = 0;
     };
+
+    // The memory at the address in a register, such as a global variable
+    // of the runtime.
+    class Indirect {
+        public:
+        Indirect(Register base) : m_base(base) {
+        }
+
+        Register base() const {
+            return m_base;
+        }
+
+        private:
+        Register m_base;
+    };
 }
 
 namespace fish::java::x64::variants {
@@ -92,7 +114,8 @@ namespace fish::java::x64::variants {
     using Operand = std::variant<
         Constant,
         Register,
-        StackSlot
+        StackSlot,
+        Indirect
     >;
 }
 
@@ -109,6 +132,10 @@ namespace fish::java::x64 {
         public:
         enum class Op {
             ret,
+
+            // Pads with no-ops to the next multiple of `code_alignment`
+            // bytes.
+            align,
         };
 
         NullaryInst(Op op) : m_op(op) {
@@ -167,14 +194,22 @@ namespace fish::java::x64 {
 
     class BinaryInst {
         public:
+        // `add`, `sub`, and `cmp` operate on 64-bit values, like the stack
+        // pointer.
+        // The 32-bit operations implement Java's int arithmetic, which
+        // wraps on overflow, and leave the upper half of the destination
+        // undefined for other users of the value.
         enum class Op {
             mov,
             add,
             sub,
-            imul,
-            shl,
-            shr,
+            add32,
+            sub32,
+            imul32,
+            shl32,
+            sar32,
             cmp,
+            cmp32,
             test8,
         };
 
@@ -220,6 +255,15 @@ namespace fish::java::x64 {
         enum class Cond {
             always,
             jz,
+            je,
+            jne,
+            jl,
+            jle,
+            jg,
+            jge,
+
+            // Unsigned, for comparing addresses.
+            jae,
         };
 
         Jump(Cond cond = Cond::always) : m_cond(cond) {
@@ -257,7 +301,10 @@ namespace fish::java::x64 {
 
     class Call {
         public:
-        Call(Function& function) : m_function(&function) {
+        // A tail call jumps to the function instead, so that it returns
+        // straight to the caller's caller.
+        Call(Function& function, bool tail = false) :
+        m_function(&function), m_tail(tail) {
         }
 
         Function& function() {
@@ -269,8 +316,13 @@ namespace fish::java::x64 {
             return const_cast<Call&>(*this).function();
         }
 
+        bool tail() const {
+            return m_tail;
+        }
+
         private:
         Function* m_function = nullptr;
+        bool m_tail = false;
     };
 
     class RegisterCall {
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "typedefs.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace fish::java {
+    /**
+     * Stack-like allocator for interpreter frames. Slots are carved out of
+     * large chunks, which are kept around after they are released, so
+     * calls don't allocate once the arena has grown to the program's
+     * maximum call depth. Chunks never move, so pointers into the arena
+     * stay valid until they are released.
+     */
+    class FrameArena {
+        public:
+        // Number of slots in each chunk. Larger allocations get a chunk
+        // of their own.
+        static constexpr std::size_t chunk_slots = 64 * 1024;
+
+        class Mark {
+            public:
+            Mark(std::size_t chunk, u32* top) : m_chunk(chunk), m_top(top) {
+            }
+
+            private:
+            friend class FrameArena;
+            std::size_t m_chunk = 0;
+            u32* m_top = nullptr;
+        };
+
+        FrameArena() {
+            m_chunks.emplace_back(chunk_slots);
+            use_chunk(0);
+        }
+
+        FrameArena(const FrameArena&) = delete;
+        FrameArena& operator=(const FrameArena&) = delete;
+
+        Mark mark() const {
+            return Mark(m_chunk, m_top);
+        }
+
+        u32* allocate(std::size_t nslots) {
+            if (nslots > static_cast<std::size_t>(m_end - m_top)) {
+                next_chunk(nslots);
+            }
+            u32* result = m_top;
+            m_top += nslots;
+            return result;
+        }
+
+        // Frees everything allocated after `mark` was obtained.
+        void release(const Mark& mark) {
+            assert(mark.m_chunk <= m_chunk);
+            use_chunk(mark.m_chunk);
+            m_top = mark.m_top;
+        }
+
+        private:
+        class Chunk {
+            public:
+            Chunk(std::size_t size) :
+            m_slots(std::make_unique<u32[]>(size)), m_size(size) {
+            }
+
+            u32* begin() const {
+                return m_slots.get();
+            }
+
+            u32* end() const {
+                return m_slots.get() + m_size;
+            }
+
+            std::size_t size() const {
+                return m_size;
+            }
+
+            private:
+            std::unique_ptr<u32[]> m_slots;
+            std::size_t m_size = 0;
+        };
+
+        std::vector<Chunk> m_chunks;
+        std::size_t m_chunk = 0;
+        u32* m_top = nullptr;
+        u32* m_end = nullptr;
+
+        void use_chunk(std::size_t index) {
+            m_chunk = index;
+            m_top = m_chunks[index].begin();
+            m_end = m_chunks[index].end();
+        }
+
+        void next_chunk(std::size_t nslots) {
+            const std::size_t index = m_chunk + 1;
+            const std::size_t size = std::max(chunk_slots, nslots);
+            if (index == m_chunks.size()) {
+                m_chunks.emplace_back(size);
+            } else if (m_chunks[index].size() < nslots) {
+                // Chunks after the current one are unused.
+                m_chunks[index] = Chunk(size);
+            }
+            use_chunk(index);
+        }
+    };
+}
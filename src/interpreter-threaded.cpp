@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "interpreter.hpp"
+#include <algorithm>
+
+// Computed gotos (labels as values) are a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+namespace fish::java {
+    u32 Interpreter::exec_threaded(const MethodInfo& method) {
+        // Must be in the same order as threaded::Handler. Not static, as
+        // a static table would need load-time relocations in the
+        // read-only text section.
+        const threaded::HandlerTable handlers = {
+            &&iconst,
+            &&iload,
+            &&istore,
+            &&iinc,
+            &&iadd,
+            &&isub,
+            &&imul,
+            &&ishl,
+            &&ishr,
+            &&if_icmpeq,
+            &&if_icmpne,
+            &&if_icmpgt,
+            &&if_icmpge,
+            &&if_icmplt,
+            &&if_icmple,
+            &&ifeq,
+            &&ifne,
+            &&ifgt,
+            &&ifge,
+            &&iflt,
+            &&ifle,
+            &&Goto,
+            &&invokestatic,
+            &&print_int,
+            &&print_char,
+            &&println_int,
+            &&println_char,
+            &&println_void,
+            &&Return,
+            &&ireturn,
+            &&getstatic,
+            &&pop,
+            &&backedge,
+            &&error,
+            &&unsupported,
+            &&end,
+        };
+
+        threaded::Code& code = threaded_code(method, handlers);
+        ++code.profile().invocations;
+
+        ThreadedStack stack(m_arena, m_max_depth);
+        ThreadedStack::Frame* frame = &stack.push(method);
+        u32* locals = frame->locals();
+        u32* sp = frame->stack();
+        const threaded::Instruction* ip = code.begin();
+
+        #define FISH_JAVA_DISPATCH() goto *ip->handler
+        #define FISH_JAVA_NEXT() do { ++ip; FISH_JAVA_DISPATCH(); } while (0)
+        #define FISH_JAVA_BRANCH_IF(cond) do { \
+            ip = (cond) ? ip->target : ip + 1; \
+            FISH_JAVA_DISPATCH(); \
+        } while (0)
+
+        FISH_JAVA_DISPATCH();
+
+        iconst: {
+            *sp++ = ip->value;
+            FISH_JAVA_NEXT();
+        }
+
+        iload: {
+            *sp++ = locals[ip->index];
+            FISH_JAVA_NEXT();
+        }
+
+        istore: {
+            locals[ip->index] = *--sp;
+            FISH_JAVA_NEXT();
+        }
+
+        iinc: {
+            locals[ip->index] += ip->value;
+            FISH_JAVA_NEXT();
+        }
+
+        iadd: {
+            --sp;
+            sp[-1] += *sp;
+            FISH_JAVA_NEXT();
+        }
+
+        isub: {
+            --sp;
+            sp[-1] -= *sp;
+            FISH_JAVA_NEXT();
+        }
+
+        imul: {
+            --sp;
+            sp[-1] *= *sp;
+            FISH_JAVA_NEXT();
+        }
+
+        ishl: {
+            --sp;
+            sp[-1] <<= *sp & 0b11111;
+            FISH_JAVA_NEXT();
+        }
+
+        ishr: {
+            --sp;
+            const u32 amount = *sp & 0b11111;
+            const u32 val = sp[-1];
+            u32 result = val >> amount;
+            if (amount > 0 && (val & (u32(1) << (32 - 1)))) {
+                result |= ~u32(0) << (32 - amount);
+            }
+            sp[-1] = result;
+            FISH_JAVA_NEXT();
+        }
+
+        if_icmpeq: {
+            sp -= 2;
+            FISH_JAVA_BRANCH_IF(s32(sp[0]) == s32(sp[1]));
+        }
+
+        if_icmpne: {
+            sp -= 2;
+            FISH_JAVA_BRANCH_IF(s32(sp[0]) != s32(sp[1]));
+        }
+
+        if_icmpgt: {
+            sp -= 2;
+            FISH_JAVA_BRANCH_IF(s32(sp[0]) > s32(sp[1]));
+        }
+
+        if_icmpge: {
+            sp -= 2;
+            FISH_JAVA_BRANCH_IF(s32(sp[0]) >= s32(sp[1]));
+        }
+
+        if_icmplt: {
+            sp -= 2;
+            FISH_JAVA_BRANCH_IF(s32(sp[0]) < s32(sp[1]));
+        }
+
+        if_icmple: {
+            sp -= 2;
+            FISH_JAVA_BRANCH_IF(s32(sp[0]) <= s32(sp[1]));
+        }
+
+        ifeq: {
+            FISH_JAVA_BRANCH_IF(s32(*--sp) == 0);
+        }
+
+        ifne: {
+            FISH_JAVA_BRANCH_IF(s32(*--sp) != 0);
+        }
+
+        ifgt: {
+            FISH_JAVA_BRANCH_IF(s32(*--sp) > 0);
+        }
+
+        ifge: {
+            FISH_JAVA_BRANCH_IF(s32(*--sp) >= 0);
+        }
+
+        iflt: {
+            FISH_JAVA_BRANCH_IF(s32(*--sp) < 0);
+        }
+
+        ifle: {
+            FISH_JAVA_BRANCH_IF(s32(*--sp) <= 0);
+        }
+
+        Goto: {
+            ip = ip->target;
+            FISH_JAVA_DISPATCH();
+        }
+
+        // NOTE: Supports only static methods in the same class, arguments
+        // must be integers, and the return type must be int or void.
+        invokestatic: {
+            threaded::CallSite& site = *ip->call_site;
+            if (site.code) {
+                ++m_call_site_stats.hits;
+            } else {
+                ++m_call_site_stats.misses;
+                const MethodInfo& target = resolve_static(site.index());
+                site.resolve(target, m_cls->cpool);
+                site.code = &threaded_code(target, handlers);
+            }
+            const MethodInfo& callee = site.method();
+            const std::size_t nargs = site.nargs();
+
+            threaded::Profile& profile = site.code->profile();
+            ++profile.invocations;
+            if (should_compile(profile)) {
+                compile(callee, handlers);
+            }
+
+            // NOTE: Assuming only 32-bit arguments
+            sp -= nargs;
+            if (profile.native) {
+                const u32 result = Jit::call(profile.native, sp, nargs);
+                if (site.nreturn() > 0) {
+                    *sp++ = result;
+                }
+                FISH_JAVA_NEXT();
+            }
+
+            frame->sp() = sp;
+            frame->pc() = ip + 1;
+
+            frame = &stack.push(callee);
+            std::copy_n(sp, nargs, frame->locals());
+            locals = frame->locals();
+            sp = frame->stack();
+            ip = site.code->begin();
+            FISH_JAVA_DISPATCH();
+        }
+
+        // The object reference pushed by `getstatic` is below the
+        // argument. Both are popped before printing, so that only `sp`
+        // stays live across the call.
+        print_int: {
+            sp -= 2;
+            program_output.put_int(static_cast<s32>(sp[1]));
+            FISH_JAVA_NEXT();
+        }
+
+        print_char: {
+            sp -= 2;
+            program_output.put_char(static_cast<s32>(sp[1]));
+            FISH_JAVA_NEXT();
+        }
+
+        println_int: {
+            sp -= 2;
+            program_output.put_int(static_cast<s32>(sp[1]));
+            program_output.put_char('\n');
+            FISH_JAVA_NEXT();
+        }
+
+        println_char: {
+            sp -= 2;
+            program_output.put_char(static_cast<s32>(sp[1]));
+            program_output.put_char('\n');
+            FISH_JAVA_NEXT();
+        }
+
+        println_void: {
+            --sp;
+            program_output.put_char('\n');
+            FISH_JAVA_NEXT();
+        }
+
+        Return: {
+            stack.pop();
+            if (stack.empty()) {
+                return 0;
+            }
+            frame = &stack.top();
+            locals = frame->locals();
+            sp = frame->sp();
+            ip = frame->pc();
+            FISH_JAVA_DISPATCH();
+        }
+
+        // NOTE: Assuming only 32-bit return values
+        ireturn: {
+            const u32 result = *--sp;
+            stack.pop();
+            if (stack.empty()) {
+                return result;
+            }
+            frame = &stack.top();
+            locals = frame->locals();
+            sp = frame->sp();
+            *sp++ = result;
+            ip = frame->pc();
+            FISH_JAVA_DISPATCH();
+        }
+
+        getstatic: {
+            // NOTE: Ignoring object
+            *sp++ = 0;
+            FISH_JAVA_NEXT();
+        }
+
+        pop: {
+            --sp;
+            FISH_JAVA_NEXT();
+        }
+
+        // Precedes backward branches. Unconditional branches leave the
+        // operand stack empty, so hot loops that end in `goto` continue in
+        // compiled code, starting at the loop header.
+        backedge: {
+            threaded::Profile& profile = *ip->profile;
+            ++profile.backedges;
+            const MethodInfo& method = frame->method();
+            if (should_compile(profile)) {
+                compile(method, handlers);
+            }
+            if (sp != frame->stack() || !should_osr(profile)) {
+                FISH_JAVA_NEXT();
+            }
+
+            const void* entry = osr_entry(method, profile, ip->index);
+            if (!entry) {
+                FISH_JAVA_NEXT();
+            }
+            const u32 result = Jit::call(
+                entry, locals, frame->code_info().max_locals
+            );
+            if (method.descriptor(m_cls->cpool).nreturn() == 0) {
+                goto Return;
+            }
+            *sp++ = result;
+            goto ireturn;
+        }
+
+        error: {
+            throw std::runtime_error(
+                threaded_code(frame->method(), handlers).error(ip->index)
+            );
+        }
+
+        unsupported: {
+            std::ostringstream msg;
+            msg << "Unsupported opcode: 0x";
+            msg << std::hex << ip->value;
+            throw std::runtime_error(msg.str());
+        }
+
+        end: {
+            program_output.flush();
+            std::cerr << (
+                "WARNING: Code finished executing without `return` "
+                "instruction"
+            ) << std::endl;
+            goto Return;
+        }
+
+        #undef FISH_JAVA_BRANCH_IF
+        #undef FISH_JAVA_NEXT
+        #undef FISH_JAVA_DISPATCH
+    }
+
+    const void* Interpreter::osr_entry(
+        const MethodInfo& method, threaded::Profile& profile,
+        std::size_t offset
+    ) {
+        auto [it, inserted] = profile.osr_entries.try_emplace(
+            offset, nullptr
+        );
+        if (inserted) {
+            try {
+                it->second = m_jit->compile_osr(method, offset);
+            } catch (const std::runtime_error&) {
+                // Keep interpreting the loop.
+            }
+        }
+        return it->second;
+    }
+
+    void Interpreter::compile(
+        const MethodInfo& method, const threaded::HandlerTable& handlers
+    ) {
+        threaded_code(method, handlers).profile().compiled = true;
+        Jit::EntryMap entries;
+        try {
+            entries = m_jit->compile(method);
+        } catch (const std::runtime_error&) {
+            // Keep interpreting methods that can't be compiled.
+            return;
+        }
+        for (auto& [minfo, entry] : entries) {
+            threaded::Profile& profile = threaded_code(
+                *minfo, handlers
+            ).profile();
+            profile.compiled = true;
+            profile.native = entry;
+        }
+    }
+}
+
+#pragma GCC diagnostic pop
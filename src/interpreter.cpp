@@ -18,8 +18,52 @@
  */
 
 #include "interpreter.hpp"
+#include <algorithm>
 
 namespace fish::java {
+    void Interpreter::exec(const MethodInfo& method) {
+        BasicStack stack(m_arena, m_max_depth);
+        Frame* frame = &stack.push(method);
+        frame->pc() = method.code.code.data();
+
+        while (true) {
+            const u8* code = frame->pc();
+            const CodeSeq& code_seq = frame->code_info().code;
+            Opcode opcode = Opcode::Return;
+            if (code < code_seq.data() + code_seq.size()) {
+                opcode = static_cast<Opcode>(*code);
+            } else {
+                program_output.flush();
+                std::cerr << (
+                    "WARNING: Code finished executing without `return` "
+                    "instruction"
+                ) << std::endl;
+            }
+
+            if (opcode == Opcode::invokestatic) {
+                frame = &instr_invokestatic(code, stack);
+                continue;
+            }
+
+            if (opcode != Opcode::Return && opcode != Opcode::ireturn) {
+                frame->pc() += instr(code, *frame);
+                continue;
+            }
+
+            // NOTE: Assuming only 32-bit return values
+            const bool has_value = opcode == Opcode::ireturn;
+            const u32 value = has_value ? frame->pop() : 0;
+            stack.pop();
+            if (stack.empty()) {
+                return;
+            }
+            frame = &stack.top();
+            if (has_value) {
+                frame->push(value);
+            }
+        }
+    }
+
     s64 Interpreter::instr(const u8* code, Frame& frame) const {
         switch (static_cast<Opcode>(*code)) {
             case Opcode::iconst_m1:
@@ -105,9 +149,9 @@ namespace fish::java {
             case Opcode::ishr: {
                 u32 amount = frame.pop() & 0b11111;
                 u32 val = frame.pop();
-                u32 result = val >>= amount;
-                if (val & (1 << (32 - 1))) {
-                    result |= ((1 << amount) - 1) << (32 - amount);
+                u32 result = val >> amount;
+                if (amount > 0 && (val & (u32(1) << (32 - 1)))) {
+                    result |= ~u32(0) << (32 - amount);
                 }
                 frame.push(result);
                 return 1;
@@ -145,26 +189,10 @@ namespace fish::java {
                 return 3;
             }
 
-            case Opcode::invokestatic: {
-                return instr_invokestatic(code, frame);
-            }
-
             case Opcode::invokevirtual: {
                 return instr_invokevirtual(code, frame);
             }
 
-            case Opcode::Return: {
-                return 0;
-            }
-
-            case Opcode::ireturn: {
-                u64 val = frame.pop();
-                if (Frame* parent = frame.parent()) {
-                    parent->push(val);
-                }
-                return 0;
-            }
-
             case Opcode::getstatic: {
                 // NOTE: Ignoring object
                 frame.push(0);
@@ -270,8 +298,38 @@ namespace fish::java {
 
     // NOTE: Supports only static methods in the same class, arguments
     // must be integers, and the return type must be int or void.
-    s64 Interpreter::instr_invokestatic(const u8* code, Frame& frame) const {
-        const u16 index = code[1] << 8 | code[2];
+    Interpreter::Frame&
+    Interpreter::instr_invokestatic(const u8* code, BasicStack& stack) {
+        const CallSite& site = call_site(code);
+        const MethodInfo& method = site.method();
+        const std::size_t nargs = site.nargs();
+
+        Frame& caller = stack.top();
+        caller.pc() = code + 3;
+
+        // NOTE: Assuming only 32-bit arguments
+        caller.sp() -= nargs;
+        const u32* args = caller.sp();
+
+        Frame& callee = stack.push(method);
+        std::copy_n(args, nargs, callee.locals());
+        callee.pc() = method.code.code.data();
+        return callee;
+    }
+
+    const CallSite& Interpreter::call_site(const u8* code) {
+        auto it = m_call_sites.find(code);
+        if (it != m_call_sites.end()) {
+            ++m_call_site_stats.hits;
+            return it->second;
+        }
+        ++m_call_site_stats.misses;
+        CallSite site(code[1] << 8 | code[2]);
+        site.resolve(resolve_static(site.index()), m_cls->cpool);
+        return m_call_sites.emplace(code, site).first->second;
+    }
+
+    const MethodInfo& Interpreter::resolve_static(u16 index) const {
         const ConstantPool& cpool = m_cls->cpool;
 
         auto& name_and_type = cpool[index].visit(
@@ -299,18 +357,7 @@ namespace fish::java {
         if (!method) {
             throw std::runtime_error("No such method");
         }
-
-        const CodeInfo& code_info = method->code;
-        Frame new_frame(code_info.max_locals, frame);
-        MethodDescriptor mdesc = method->descriptor(cpool);
-        const std::size_t nargs = mdesc.nargs();
-
-        // NOTE: Assuming only 32-bit arguments
-        for (std::size_t i = nargs; i > 0; --i) {
-            new_frame.local(i - 1) = frame.pop();
-        }
-        exec(code_info.code, new_frame);
-        return 3;
+        return *method;
     }
 
     // NOTE: Supports only print() and println() with int, char, or void arg.
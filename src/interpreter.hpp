@@ -18,93 +18,118 @@
  */
 
 #pragma once
+#include "call-site.hpp"
+#include "call-stack.hpp"
 #include "class-file.hpp"
+#include "frame-arena.hpp"
+#include "jit.hpp"
 #include "method-descriptor.hpp"
 #include "method-table.hpp"
 #include "opcode.hpp"
+#include "output-buffer.hpp"
+#include "threaded-code.hpp"
 #include "typedefs.hpp"
 #include "utils.hpp"
 #include <cassert>
+#include <cstddef>
 #include <ios>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace fish::java {
     class Interpreter {
-        using Stack = std::vector<u32>;
-        using Locals = std::vector<u32>;
+        using BasicStack = CallStack<const u8*>;
+        using ThreadedStack = CallStack<const threaded::Instruction*>;
+        using Frame = BasicStack::Frame;
 
-        struct Frame {
-            Frame(std::size_t nlocals) :
-            Frame(nlocals, nullptr) {
-            }
-
-            Frame(std::size_t nlocals, Frame& parent) :
-            Frame(nlocals, &parent) {
-            }
-
-            void push(u32 val) {
-                m_stack.push_back(val);
-            }
-
-            u32 pop() {
-                u32 val = m_stack.back();
-                m_stack.pop_back();
-                return val;
-            }
-
-            u32& local(std::size_t i) {
-                assert(i < m_locals.size());
-                return m_locals[i];
-            }
-
-            Frame* parent() {
-                return m_parent;
-            }
+        public:
+        enum class Engine {
+            // Decodes each instruction every time it is executed.
+            basic,
 
-            private:
-            Frame(std::size_t nlocals, Frame* parent) :
-            m_locals(nlocals, 0), m_parent(parent) {
-            }
+            // Runs pre-decoded code with direct-threaded dispatch.
+            threaded,
 
-            Stack m_stack;
-            Locals m_locals;
-            Frame* m_parent = nullptr;
+            // Like `threaded`, but compiles frequently used methods to
+            // native code.
+            tiered,
         };
 
-        public:
-        Interpreter(const ClassFile& cls) : m_cls(&cls) {
+        // Maximum number of nested Java calls before StackOverflowError
+        // is thrown.
+        static constexpr std::size_t default_max_depth = 1 << 16;
+
+        // Number of calls or backward branches after which the tiered
+        // engine compiles a method.
+        static constexpr u64 jit_invocation_threshold = 1000;
+        static constexpr u64 jit_backedge_threshold = 10000;
+
+        Interpreter(
+            const ClassFile& cls, Engine engine = Engine::threaded,
+            std::size_t max_depth = default_max_depth
+        ) :
+        m_cls(&cls), m_engine(engine), m_max_depth(max_depth) {
+            if (engine == Engine::tiered) {
+                m_jit.emplace(cls);
+            }
         }
 
-        void run() const {
+        void run() {
             const MethodInfo* method = m_cls->methods.main(m_cls->cpool);
             if (!method) {
                 throw std::runtime_error("Could not find main() method");
             }
-            const CodeInfo& code_info = method->code;
-            Frame frame(code_info.max_locals);
-            exec(code_info.code, frame);
+            if (m_engine == Engine::basic) {
+                exec(*method);
+                return;
+            }
+            exec_threaded(*method);
         }
 
-        private:
-        const ClassFile* m_cls = nullptr;
+        const ClassFile& cls() const {
+            return *m_cls;
+        }
+
+        const CallSiteStats& call_site_stats() const {
+            return m_call_site_stats;
+        }
 
-        void exec(const CodeSeq& code, Frame& frame) const {
-            for (u64 i = 0; i < code.size();) {
-                const s64 inc = instr(&code[i], frame);
-                if (inc == 0) {
-                    return;
+        // Profiles of the methods run by the threaded and tiered engines,
+        // in class file order.
+        std::vector<std::pair<const MethodInfo*, const threaded::Profile*>>
+        profiles() const {
+            std::vector<
+                std::pair<const MethodInfo*, const threaded::Profile*>
+            > result;
+            for (const MethodInfo& minfo : m_cls->methods) {
+                auto it = m_threaded.find(&minfo);
+                if (it != m_threaded.end()) {
+                    result.emplace_back(&minfo, &it->second.profile());
                 }
-                i += inc;
             }
-            std::cerr << (
-                "WARNING: Code finished executing without `return` "
-                "instruction"
-            ) << std::endl;
+            return result;
         }
 
+        private:
+        const ClassFile* m_cls = nullptr;
+        Engine m_engine = Engine::threaded;
+        std::size_t m_max_depth = default_max_depth;
+        FrameArena m_arena;
+        std::unordered_map<const MethodInfo*, threaded::Code> m_threaded;
+
+        // Call sites used by the basic engine, keyed by the address of
+        // the `invokestatic` instruction.
+        std::unordered_map<const u8*, CallSite> m_call_sites;
+        CallSiteStats m_call_site_stats;
+        std::optional<Jit> m_jit;
+
+        void exec(const MethodInfo& method);
         s64 instr(const u8* code, Frame& frame) const;
         s64 instr_icmp(const u8* code, Frame& frame) const;
         s64 instr_if(const u8* code, Frame& frame) const;
@@ -114,8 +139,47 @@ namespace fish::java {
             std::decay_t<T>*, pool::BaseMethodRef*
         >;
 
-        s64 instr_invokestatic(const u8* code, Frame& frame) const;
+        Frame& instr_invokestatic(const u8* code, BasicStack& stack);
         s64 instr_invokevirtual(const u8* code, Frame& frame) const;
+        const MethodInfo& resolve_static(u16 index) const;
+        const CallSite& call_site(const u8* code);
+
+        threaded::Code& threaded_code(
+            const MethodInfo& method, const threaded::HandlerTable& handlers
+        ) {
+            auto it = m_threaded.find(&method);
+            if (it == m_threaded.end()) {
+                it = m_threaded.try_emplace(
+                    &method, *m_cls, method.code, handlers
+                ).first;
+            }
+            return it->second;
+        }
+
+        u32 exec_threaded(const MethodInfo& method);
+
+        // Whether the tiered engine should compile a method now.
+        bool should_compile(const threaded::Profile& profile) const {
+            return m_jit && !profile.compiled && (
+                profile.invocations >= jit_invocation_threshold ||
+                profile.backedges >= jit_backedge_threshold
+            );
+        }
+
+        void compile(
+            const MethodInfo& method, const threaded::HandlerTable& handlers
+        );
+
+        // Whether the tiered engine should leave the interpreter at a loop
+        // header. Only possible when the operand stack is empty.
+        bool should_osr(const threaded::Profile& profile) const {
+            return m_jit && profile.backedges >= jit_backedge_threshold;
+        }
+
+        const void* osr_entry(
+            const MethodInfo& method, threaded::Profile& profile,
+            std::size_t offset
+        );
 
         void run_print(const MethodDescriptor& mdesc, Frame& frame) const {
             utils::check_print_method_descriptor(mdesc, "print()");
@@ -125,7 +189,7 @@ namespace fish::java {
         void run_println(const MethodDescriptor& mdesc, Frame& frame) const {
             utils::check_print_method_descriptor(mdesc, "println()");
             print_raw(mdesc, frame);
-            std::cout << std::endl;
+            program_output.put_char('\n');
         }
 
         void print_raw(const MethodDescriptor& mdesc, Frame& frame) const {
@@ -133,10 +197,10 @@ namespace fish::java {
                 return;
             }
             if (mdesc.arg(0) == "C") {
-                std::cout << static_cast<char>(static_cast<s32>(frame.pop()));
+                program_output.put_char(static_cast<s32>(frame.pop()));
                 return;
             }
-            std::cout << static_cast<s32>(frame.pop());
+            program_output.put_int(static_cast<s32>(frame.pop()));
         }
     };
 }
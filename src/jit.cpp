@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "jit.hpp"
+#include "call-stack.hpp"
+#include "output-buffer.hpp"
+#include "compiler/arena.hpp"
+#include "compiler/java-build.hpp"
+#include "compiler/ssa-build.hpp"
+#include "compiler/ssa-optimize.hpp"
+#include "compiler/x64-assemble.hpp"
+#include "compiler/x64-build.hpp"
+#include "compiler/x64-builtins.hpp"
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <cstring>
+#include <stdexcept>
+
+namespace fish::java {
+    // Set by fish_java_stack_overflow() for Jit::call().
+    static bool stack_overflowed = false;
+
+    // Bytes of stack compiled code may use: the stack size limit, less
+    // room for the frames that call it and for the output functions and
+    // fish_java_stack_overflow() it calls near the limit.
+    static u64 native_stack_size() {
+        constexpr u64 reserve = 256 * 1024;
+        constexpr u64 unlimited = 64 * 1024 * 1024;
+        static const u64 size = [] {
+            rlimit limit;
+            u64 size = unlimited;
+            if (getrlimit(RLIMIT_STACK, &limit) == 0) {
+                if (limit.rlim_cur != RLIM_INFINITY) {
+                    size = limit.rlim_cur;
+                }
+            }
+            return size > 2 * reserve ? size - reserve : size / 2;
+        }();
+        return size;
+    }
+
+    u32 Jit::call(const void* entry, const u32* args, std::size_t nargs) {
+        const u64 result = fish_java_x64_enter(
+            entry, args, nargs, native_stack_size()
+        );
+        if (stack_overflowed) {
+            stack_overflowed = false;
+            throw StackOverflowError();
+        }
+        return static_cast<u32>(result);
+    }
+
+    Jit::CodeBuffer::CodeBuffer(const std::vector<u8>& code) :
+    m_size(code.size()) {
+        void* memory = mmap(
+            nullptr, m_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+        );
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("Could not allocate x64 code buffer");
+        }
+        std::memcpy(memory, code.data(), m_size);
+        if (mprotect(memory, m_size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, m_size);
+            throw std::runtime_error("Could not make x64 code executable");
+        }
+        m_memory = static_cast<u8*>(memory);
+    }
+
+    Jit::CodeBuffer::~CodeBuffer() {
+        munmap(m_memory, m_size);
+    }
+
+    Jit::EntryMap Jit::compile(const MethodInfo& method) {
+        // Frees every IR at once when compilation is done.
+        Arena arena;
+        Arena::Scope scope(arena);
+        java::Program j_program;
+        java::ProgramBuilder j_builder(j_program, *m_cls);
+        j_builder.build(method);
+
+        auto code = assemble(j_program);
+        EntryMap entries;
+        for (auto& [minfo, j_func] : j_builder.functions()) {
+            entries.emplace(minfo, code.at(j_func));
+        }
+        return entries;
+    }
+
+    const void*
+    Jit::compile_osr(const MethodInfo& method, std::size_t offset) {
+        Arena arena;
+        Arena::Scope scope(arena);
+        java::Program j_program;
+        java::ProgramBuilder j_builder(j_program, *m_cls);
+        auto& j_func = j_builder.build_osr(method, offset);
+        return assemble(j_program).at(&j_func);
+    }
+
+    std::unordered_map<const java::Function*, const void*>
+    Jit::assemble(const java::Program& j_program) {
+        ssa::Program ssa_program;
+        ssa::ProgramBuilder ssa_builder(ssa_program, j_program);
+        ssa_builder.build();
+        ssa::optimize(ssa_program, x64::registers.size());
+
+        x64::Program x64_program;
+        x64::ProgramBuilder x64_builder(x64_program, ssa_program);
+        x64_builder.build();
+
+        x64::Assembler assembler(x64_program);
+        assembler.assemble();
+        const u8* code = m_buffers.emplace_back(assembler.code()).data();
+
+        std::unordered_map<const java::Function*, const void*> entries;
+        for (auto& j_func : j_program.functions()) {
+            auto& ssa_func = ssa_builder.function(j_func);
+            auto& x64_func = x64_builder.function(ssa_func);
+            entries.emplace(&j_func, code + assembler.find(x64_func));
+        }
+        return entries;
+    }
+}
+
+void fish_java_stack_overflow() {
+    fish::java::program_output.flush();
+    fish::java::stack_overflowed = true;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "class-file.hpp"
+#include "method-info.hpp"
+#include "typedefs.hpp"
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace fish::java::java {
+    class Function;
+    class Program;
+}
+
+namespace fish::java {
+    /**
+     * Compiles methods to native code at run time, using the same pipeline
+     * as the "compile" command.
+     */
+    class Jit {
+        public:
+        // Maps each compiled method to its entry point.
+        using EntryMap = std::unordered_map<const MethodInfo*, const void*>;
+
+        explicit Jit(const ClassFile& cls) : m_cls(&cls) {
+        }
+
+        // Compiles `method` along with every method it can call, as
+        // compiled code can only call other compiled code. Throws
+        // std::runtime_error if any of them use unsupported features.
+        EntryMap compile(const MethodInfo& method);
+
+        // Compiles a version of `method` that starts at the instruction at
+        // bytecode offset `offset` and takes the method's local variables
+        // as arguments. Used for on-stack replacement. Throws
+        // std::runtime_error like compile().
+        const void* compile_osr(const MethodInfo& method, std::size_t offset);
+
+        // Calls compiled code. Throws StackOverflowError if it recurses
+        // too deeply, after flushing what it printed.
+        // NOTE: Assuming only 32-bit arguments and return values
+        static u32 call(const void* entry, const u32* args, std::size_t nargs);
+
+        private:
+        // Executable copy of assembled code.
+        class CodeBuffer {
+            public:
+            explicit CodeBuffer(const std::vector<u8>& code);
+            CodeBuffer(const CodeBuffer&) = delete;
+            CodeBuffer& operator=(const CodeBuffer&) = delete;
+            ~CodeBuffer();
+
+            const u8* data() const {
+                return m_memory;
+            }
+
+            private:
+            u8* m_memory = nullptr;
+            std::size_t m_size = 0;
+        };
+
+        const ClassFile* m_cls = nullptr;
+        std::list<CodeBuffer> m_buffers;
+
+        // Compiles every function in `j_program` and returns their entry
+        // points.
+        std::unordered_map<const java::Function*, const void*>
+        assemble(const java::Program& j_program);
+    };
+}
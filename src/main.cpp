@@ -19,9 +19,13 @@
 
 #include "class-file.hpp"
 #include "interpreter.hpp"
+#include "jit.hpp"
+#include "output-buffer.hpp"
 #include "stream.hpp"
+#include "compiler/arena.hpp"
 #include "compiler/java-build.hpp"
 #include "compiler/ssa-build.hpp"
+#include "compiler/ssa-optimize.hpp"
 #include "compiler/x64-build.hpp"
 #include "compiler/x64-assemble.hpp"
 #include <sys/mman.h>
@@ -38,92 +42,31 @@ using namespace fish::java;
 
 static constexpr const char* usage = R"(
 Usage:
-  compiler interpret <class-file>
-  compiler compile <class-file> [<x64-out>]
+  compiler run <class-file> [<max-depth>]
+  compiler interpret <class-file> [<engine> [<max-depth>]]
+  compiler profile <class-file> [<engine> [<max-depth>]]
+  compiler compile <class-file> [<x64-out> [<allocator>]]
   compiler ssa <class-file>
 
-If <x64-out> is provided to the "compile" command, the compiled code will be
-written to that file. Otherwise, it will be run immediately.
-)" + 1;
-
-static bool propagate_copies(ssa::Function& function) {
-    std::map<ssa::Instruction*, ssa::Value> map;
-    bool changed = false;
-
-    auto propagate = [&] (ssa::Value& input) {
-        auto input_inst = input.get_if<ssa::InstructionIterator>();
-        if (!input_inst) return;
-        auto map_entry = map.find(&**input_inst);
-        if (map_entry == map.end()) return;
-        input = ssa::Value(map_entry->second);
-        changed = true;
-    };
-
-    for (ssa::BasicBlock& block : function.blocks()) {
-        auto it = block.instructions().begin();
-        auto end = block.instructions().end();
-
-        for (; it != end; ++it) {
-            for (ssa::Value* input : it->inputs()) {
-                propagate(*input);
-            }
-
-            auto move = it->get_if<ssa::Move>();
-            if (!move) continue;
-            map.emplace(&*it, move->value());
-        }
+The "run" command starts by interpreting the program, and compiles methods to
+native code once they have been called or have looped enough times. It is the
+same as the "interpret" command with the "tiered" engine.
 
-        for (ssa::Value* input : block.terminator().inputs()) {
-            propagate(*input);
-        }
-    }
-    return changed;
-}
+<engine> selects how the "interpret" command executes bytecode: "threaded"
+(the default) runs pre-decoded code with direct-threaded dispatch, "basic"
+decodes each instruction as it is executed, and "tiered" is described above.
+<max-depth> is the maximum number of nested interpreted method calls before a
+StackOverflowError is raised. Compiled code raises it when it would exceed the
+stack size limit instead.
 
-static bool eliminate_unused(ssa::Function& function) {
-    std::set<ssa::Instruction*> used;
-    for (ssa::BasicBlock& block : function.blocks()) {
-        for (auto& inst : block.instructions()) {
-            for (ssa::Value* input : inst.inputs()) {
-                auto input_inst = input->get_if<ssa::InstructionIterator>();
-                if (!input_inst) continue;
-                used.insert(&**input_inst);
-            }
-        }
-
-        for (ssa::Value* input : block.terminator().inputs()) {
-            auto input_inst = input->get_if<ssa::InstructionIterator>();
-            if (!input_inst) continue;
-            used.insert(&**input_inst);
-        }
-    }
-
-    std::list<ssa::InstructionIterator> remove;
-    for (ssa::BasicBlock& block : function.blocks()) {
-        auto it = block.instructions().begin();
-        auto end = block.instructions().end();
-
-        for (; it != end; ++it) {
-            if (used.count(&*it) > 0) continue;
-            if (it->has_side_effect()) continue;
-            remove.push_back(it);
-        }
-    }
+The "profile" command is like "interpret", but also prints interpreter
+statistics to standard error when the program exits.
 
-    for (auto inst : remove) {
-        inst->block().instructions().erase(inst);
-    }
-    return !remove.empty();
-}
-
-static void optimize(ssa::Function& function) {
-    static constexpr std::size_t max_rounds = 20;
-    std::size_t i = 0;
-    do {} while (++i <= max_rounds && (
-        propagate_copies(function) ||
-        eliminate_unused(function)
-    ));
-}
+If <x64-out> is provided to the "compile" command, the compiled code will be
+written to that file. Otherwise, or if it is "-", it will be run immediately.
+<allocator> selects the register allocator: "coloring" (the default) produces
+better code, and "linear-scan" compiles large methods much faster.
+)" + 1;
 
 static void cls_to_ssa(const ClassFile& cls, ssa::Program& ssa_program) {
     java::Program j_program;
@@ -133,24 +76,43 @@ static void cls_to_ssa(const ClassFile& cls, ssa::Program& ssa_program) {
     auto ssa_builder = ssa::ProgramBuilder(ssa_program, j_program);
     ssa_builder.build();
 
-    for (auto& function : ssa_program.functions()) {
-        optimize(function);
-    }
+    ssa::optimize(ssa_program, x64::registers.size());
 }
 
 static int cmd_ssa(const ClassFile& cls, int, char**) {
+    Arena arena;
+    Arena::Scope scope(arena);
     ssa::Program ssa_program;
     cls_to_ssa(cls, ssa_program);
     std::cout << ssa_program;
     return EXIT_SUCCESS;
 }
 
+static void report_stack_overflow() {
+    program_output.flush();
+    std::cerr << "Exception in thread \"main\" ";
+    std::cerr << "java.lang.StackOverflowError\n";
+}
+
 static int cmd_compile(const ClassFile& cls, int argc, char** argv) {
+    auto allocator = x64::AllocatorKind::coloring;
+    if (argc > 4) {
+        if (argv[4] == std::string("linear-scan")) {
+            allocator = x64::AllocatorKind::linear_scan;
+        } else if (argv[4] != std::string("coloring")) {
+            std::cerr << "Unknown register allocator: " << argv[4] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The IRs are freed all at once when this function returns.
+    Arena arena;
+    Arena::Scope scope(arena);
     ssa::Program ssa_program;
     cls_to_ssa(cls, ssa_program);
 
     x64::Program x64_program;
-    x64::ProgramBuilder x64_builder(x64_program, ssa_program);
+    x64::ProgramBuilder x64_builder(x64_program, ssa_program, allocator);
     x64_builder.build();
 
     const x64::Function* entry_func = nullptr;
@@ -170,7 +132,7 @@ static int cmd_compile(const ClassFile& cls, int argc, char** argv) {
     auto& code = x64_assembler.code();
     std::size_t entry_offset = x64_assembler.find(*entry_func);
 
-    if (argc > 3) {
+    if (argc > 3 && argv[3] != std::string("-")) {
         std::ofstream out(argv[3]);
         if (!out.is_open()) {
             std::cerr << "Could not open x64 output file.\n";
@@ -191,14 +153,96 @@ static int cmd_compile(const ClassFile& cls, int argc, char** argv) {
         return EXIT_FAILURE;
     }
     std::memcpy(memory, &code[0], code.size());
-    ((void (*)())(memory + entry_offset))();
+    try {
+        Jit::call(memory + entry_offset, nullptr, 0);
+    } catch (const StackOverflowError&) {
+        report_stack_overflow();
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
 
-static int cmd_interpret(const ClassFile& cls, int, char**) {
-    Interpreter interpreter(cls);
-    interpreter.run();
-    return EXIT_SUCCESS;
+static void print_profile(const Interpreter& interpreter) {
+    const CallSiteStats& stats = interpreter.call_site_stats();
+    const u64 calls = stats.hits + stats.misses;
+    std::cerr << "Call site cache: " << stats.hits << " hits, ";
+    std::cerr << stats.misses << " misses";
+    if (calls > 0) {
+        std::cerr << " (" << 100.0 * stats.hits / calls << "% hit rate)";
+    }
+    std::cerr << "\n";
+
+    for (auto [minfo, method_profile] : interpreter.profiles()) {
+        std::cerr << minfo->name(interpreter.cls().cpool) << ": ";
+        std::cerr << method_profile->invocations << " calls, ";
+        std::cerr << method_profile->backedges << " backward branches";
+        if (method_profile->native) {
+            std::cerr << " (compiled)";
+        }
+        std::cerr << "\n";
+    }
+}
+
+static bool parse_max_depth(const char* arg, std::size_t& max_depth) {
+    char* end = nullptr;
+    max_depth = std::strtoull(arg, &end, 10);
+    if (*end != '\0' || max_depth == 0) {
+        std::cerr << "Invalid maximum depth: " << arg << "\n";
+        return false;
+    }
+    return true;
+}
+
+static int interpret(
+    const ClassFile& cls, Interpreter::Engine engine, std::size_t max_depth,
+    bool profile
+) {
+    Interpreter interpreter(cls, engine, max_depth);
+    int status = EXIT_SUCCESS;
+    try {
+        interpreter.run();
+    } catch (const StackOverflowError&) {
+        report_stack_overflow();
+        status = EXIT_FAILURE;
+    } catch (...) {
+        // Keep what the program printed before the error.
+        program_output.flush();
+        throw;
+    }
+    if (profile) {
+        program_output.flush();
+        print_profile(interpreter);
+    }
+    return status;
+}
+
+static int cmd_interpret(
+        const ClassFile& cls, int argc, char** argv, bool profile) {
+    auto engine = Interpreter::Engine::threaded;
+    if (argc > 3) {
+        if (argv[3] == std::string("basic")) {
+            engine = Interpreter::Engine::basic;
+        } else if (argv[3] == std::string("tiered")) {
+            engine = Interpreter::Engine::tiered;
+        } else if (argv[3] != std::string("threaded")) {
+            std::cerr << "Unknown interpreter engine: " << argv[3] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::size_t max_depth = Interpreter::default_max_depth;
+    if (argc > 4 && !parse_max_depth(argv[4], max_depth)) {
+        return EXIT_FAILURE;
+    }
+    return interpret(cls, engine, max_depth, profile);
+}
+
+static int cmd_run(const ClassFile& cls, int argc, char** argv) {
+    std::size_t max_depth = Interpreter::default_max_depth;
+    if (argc > 3 && !parse_max_depth(argv[3], max_depth)) {
+        return EXIT_FAILURE;
+    }
+    return interpret(cls, Interpreter::Engine::tiered, max_depth, false);
 }
 
 int main(int argc, char** argv) {
@@ -222,8 +266,14 @@ int main(int argc, char** argv) {
         throw std::runtime_error("Unexpected extra data in class file");
     }
 
+    if (argv[1] == std::string("run")) {
+        return cmd_run(cls, argc, argv);
+    }
     if (argv[1] == std::string("interpret")) {
-        return cmd_interpret(cls, argc, argv);
+        return cmd_interpret(cls, argc, argv, false);
+    }
+    if (argv[1] == std::string("profile")) {
+        return cmd_interpret(cls, argc, argv, true);
     }
     if (argv[1] == std::string("compile")) {
         return cmd_compile(cls, argc, argv);
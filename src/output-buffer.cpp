@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "output-buffer.hpp"
+#include <cerrno>
+
+namespace fish::java {
+    void OutputBuffer::put_int(s64 value) {
+        // Enough for the sign and all digits of any 64-bit integer.
+        constexpr std::size_t max_length = 20;
+        if (capacity - m_size < max_length) {
+            flush();
+        }
+
+        u64 magnitude = static_cast<u64>(value);
+        if (value < 0) {
+            m_data[m_size++] = '-';
+            magnitude = -magnitude;
+        }
+
+        char digits[max_length];
+        std::size_t ndigits = 0;
+        do {
+            digits[ndigits++] = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude > 0);
+
+        while (ndigits > 0) {
+            m_data[m_size++] = digits[--ndigits];
+        }
+    }
+
+    void OutputBuffer::flush() {
+        const char* data = m_data.data();
+        std::size_t size = m_size;
+        m_size = 0;
+        while (size > 0) {
+            const ssize_t written = write(m_fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                // Output is discarded on error, like C's stdio.
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+}
+
+using fish::java::program_output;
+using fish::java::s64;
+
+void fish_java_print_char(s64 value) {
+    program_output.put_char(static_cast<char>(value));
+}
+
+void fish_java_print_int(s64 value) {
+    program_output.put_int(value);
+}
+
+void fish_java_println_void() {
+    program_output.put_char('\n');
+}
+
+void fish_java_println_char(s64 value) {
+    program_output.put_char(static_cast<char>(value));
+    program_output.put_char('\n');
+}
+
+void fish_java_println_int(s64 value) {
+    program_output.put_int(value);
+    program_output.put_char('\n');
+}
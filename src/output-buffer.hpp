@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "typedefs.hpp"
+#include <unistd.h>
+#include <array>
+#include <cstddef>
+
+namespace fish::java {
+    /**
+     * Buffers the output of Java programs. Data is written only when the
+     * buffer fills up, when flush() is called, or at exit.
+     */
+    class OutputBuffer {
+        public:
+        static constexpr std::size_t capacity = 64 * 1024;
+
+        explicit OutputBuffer(int fd) : m_fd(fd) {
+        }
+
+        OutputBuffer(const OutputBuffer&) = delete;
+        OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+        ~OutputBuffer() {
+            flush();
+        }
+
+        void put_char(char c) {
+            if (m_size == capacity) {
+                flush();
+            }
+            m_data[m_size++] = c;
+        }
+
+        void put_int(s64 value);
+        void flush();
+
+        private:
+        int m_fd = -1;
+        std::size_t m_size = 0;
+        std::array<char, capacity> m_data;
+    };
+
+    // Standard output of the Java program, shared by the interpreter and
+    // compiled code.
+    inline OutputBuffer program_output(STDOUT_FILENO);
+}
+
+// Called by the builtins in compiler/x64-builtins.s.
+extern "C" {
+    void fish_java_print_char(fish::java::s64 value);
+    void fish_java_print_int(fish::java::s64 value);
+    void fish_java_println_void();
+    void fish_java_println_char(fish::java::s64 value);
+    void fish_java_println_int(fish::java::s64 value);
+}
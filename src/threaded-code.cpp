@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "threaded-code.hpp"
+#include "method-descriptor.hpp"
+#include "opcode.hpp"
+#include "utils.hpp"
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fish::java::threaded {
+    namespace {
+        // Marks bytecode offsets that don't begin an instruction.
+        constexpr std::size_t no_instruction = (
+            std::numeric_limits<std::size_t>::max()
+        );
+
+        struct Decoded {
+            Handler handler = Handler::unsupported;
+            u32 index = 0;
+            s32 value = 0;
+            std::size_t length = 1;
+
+            // Bytecode offset of the branch target, if any.
+            std::optional<std::size_t> target;
+
+            // Error raised by `error` handlers.
+            std::string message;
+        };
+
+        s16 read_s16(const u8* code) {
+            return static_cast<s16>(code[1] << 8 | code[2]);
+        }
+
+        u16 read_u16(const u8* code) {
+            return code[1] << 8 | code[2];
+        }
+
+        Decoded decode_branch(
+                Handler handler, const u8* code, std::size_t offset) {
+            Decoded result;
+            result.handler = handler;
+            result.length = 3;
+            result.target = offset + read_s16(code);
+            return result;
+        }
+
+        Handler print_handler(
+                const std::string& name, const MethodDescriptor& mdesc) {
+            utils::check_print_method_descriptor(mdesc, name + "()");
+            const bool newline = name == "println";
+            if (mdesc.nargs() == 0) {
+                if (!newline) {
+                    throw std::runtime_error(
+                        "print() must take an argument."
+                    );
+                }
+                return Handler::println_void;
+            }
+            if (mdesc.arg(0) == "C") {
+                return newline ? Handler::println_char : Handler::print_char;
+            }
+            return newline ? Handler::println_int : Handler::print_int;
+        }
+
+        // NOTE: Supports only print() and println() with int, char, or
+        // void arg, like Interpreter::instr_invokevirtual().
+        Handler decode_invokevirtual(const ClassFile& cls, u16 index) {
+            const ConstantPool& cpool = cls.cpool;
+            auto& name_and_type = cpool[index].visit(
+                [&] (auto& obj) -> const pool::NameAndType& {
+                    constexpr bool is_method_ref = std::is_base_of_v<
+                        pool::BaseMethodRef, std::decay_t<decltype(obj)>
+                    >;
+                    if constexpr (!is_method_ref) {
+                        throw std::runtime_error(
+                            "Expected method entry in constant pool"
+                        );
+                    }
+                    else {
+                        return cpool.get<pool::NameAndType>(
+                            obj.name_type_index
+                        );
+                    }
+                }
+            );
+
+            auto& name = cpool.get<pool::UTF8>(name_and_type.name_index).str;
+            auto& sig = cpool.get<pool::UTF8>(name_and_type.desc_index).str;
+            if (name != "print" && name != "println") {
+                std::ostringstream msg;
+                msg << "Unsupported virtual method: " << name;
+                throw std::runtime_error(msg.str());
+            }
+            return print_handler(name, MethodDescriptor(sig));
+        }
+
+        Decoded decode(
+                const ClassFile& cls, const u8* code, std::size_t offset) {
+            Decoded result;
+            const Opcode opcode = static_cast<Opcode>(*code);
+            switch (opcode) {
+                case Opcode::iconst_m1:
+                case Opcode::iconst_0:
+                case Opcode::iconst_1:
+                case Opcode::iconst_2:
+                case Opcode::iconst_3:
+                case Opcode::iconst_4:
+                case Opcode::iconst_5: {
+                    result.handler = Handler::iconst;
+                    result.value = (
+                        static_cast<s32>(*code) -
+                        static_cast<s32>(Opcode::iconst_0)
+                    );
+                    return result;
+                }
+
+                case Opcode::iload: {
+                    result.handler = Handler::iload;
+                    result.index = code[1];
+                    result.length = 2;
+                    return result;
+                }
+
+                case Opcode::iload_0:
+                case Opcode::iload_1:
+                case Opcode::iload_2:
+                case Opcode::iload_3: {
+                    result.handler = Handler::iload;
+                    result.index = (
+                        static_cast<s32>(*code) -
+                        static_cast<s32>(Opcode::iload_0)
+                    );
+                    return result;
+                }
+
+                case Opcode::istore: {
+                    result.handler = Handler::istore;
+                    result.index = code[1];
+                    result.length = 2;
+                    return result;
+                }
+
+                case Opcode::istore_0:
+                case Opcode::istore_1:
+                case Opcode::istore_2:
+                case Opcode::istore_3: {
+                    result.handler = Handler::istore;
+                    result.index = (
+                        static_cast<s32>(*code) -
+                        static_cast<s32>(Opcode::istore_0)
+                    );
+                    return result;
+                }
+
+                case Opcode::iinc: {
+                    result.handler = Handler::iinc;
+                    result.index = code[1];
+                    result.value = static_cast<s8>(code[2]);
+                    result.length = 3;
+                    return result;
+                }
+
+                case Opcode::iadd: {
+                    result.handler = Handler::iadd;
+                    return result;
+                }
+
+                case Opcode::isub: {
+                    result.handler = Handler::isub;
+                    return result;
+                }
+
+                case Opcode::imul: {
+                    result.handler = Handler::imul;
+                    return result;
+                }
+
+                case Opcode::ishl: {
+                    result.handler = Handler::ishl;
+                    return result;
+                }
+
+                case Opcode::ishr: {
+                    result.handler = Handler::ishr;
+                    return result;
+                }
+
+                case Opcode::if_icmpeq: {
+                    return decode_branch(Handler::if_icmpeq, code, offset);
+                }
+
+                case Opcode::if_icmpne: {
+                    return decode_branch(Handler::if_icmpne, code, offset);
+                }
+
+                case Opcode::if_icmpgt: {
+                    return decode_branch(Handler::if_icmpgt, code, offset);
+                }
+
+                case Opcode::if_icmpge: {
+                    return decode_branch(Handler::if_icmpge, code, offset);
+                }
+
+                case Opcode::if_icmplt: {
+                    return decode_branch(Handler::if_icmplt, code, offset);
+                }
+
+                case Opcode::if_icmple: {
+                    return decode_branch(Handler::if_icmple, code, offset);
+                }
+
+                case Opcode::ifeq: {
+                    return decode_branch(Handler::ifeq, code, offset);
+                }
+
+                case Opcode::ifne: {
+                    return decode_branch(Handler::ifne, code, offset);
+                }
+
+                case Opcode::ifgt: {
+                    return decode_branch(Handler::ifgt, code, offset);
+                }
+
+                case Opcode::ifge: {
+                    return decode_branch(Handler::ifge, code, offset);
+                }
+
+                case Opcode::iflt: {
+                    return decode_branch(Handler::iflt, code, offset);
+                }
+
+                case Opcode::ifle: {
+                    return decode_branch(Handler::ifle, code, offset);
+                }
+
+                case Opcode::Goto: {
+                    return decode_branch(Handler::Goto, code, offset);
+                }
+
+                case Opcode::bipush: {
+                    result.handler = Handler::iconst;
+                    result.value = static_cast<s8>(code[1]);
+                    result.length = 2;
+                    return result;
+                }
+
+                case Opcode::sipush: {
+                    result.handler = Handler::iconst;
+                    result.value = read_s16(code);
+                    result.length = 3;
+                    return result;
+                }
+
+                case Opcode::invokestatic: {
+                    result.handler = Handler::invokestatic;
+                    result.index = read_u16(code);
+                    result.length = 3;
+                    return result;
+                }
+
+                case Opcode::invokevirtual: {
+                    result.length = 3;
+                    try {
+                        result.handler = decode_invokevirtual(
+                            cls, read_u16(code)
+                        );
+                    } catch (const std::runtime_error& e) {
+                        // Error is raised only if the instruction is
+                        // reached, like Interpreter::instr_invokevirtual().
+                        result.handler = Handler::error;
+                        result.message = e.what();
+                    }
+                    return result;
+                }
+
+                case Opcode::Return: {
+                    result.handler = Handler::Return;
+                    return result;
+                }
+
+                case Opcode::ireturn: {
+                    result.handler = Handler::ireturn;
+                    return result;
+                }
+
+                case Opcode::getstatic: {
+                    result.handler = Handler::getstatic;
+                    result.length = 3;
+                    return result;
+                }
+
+                case Opcode::pop: {
+                    result.handler = Handler::pop;
+                    return result;
+                }
+
+                default: {
+                    // Error is raised only if the instruction is reached.
+                    result.handler = Handler::unsupported;
+                    result.value = *code;
+                    result.length = 0;
+                    return result;
+                }
+            }
+        }
+    }
+
+    Code::Code(
+        const ClassFile& cls, const CodeInfo& code_info,
+        const HandlerTable& handlers
+    ) {
+        const CodeSeq& code = code_info.code;
+        std::vector<std::size_t> offset_map(code.size(), no_instruction);
+        std::vector<std::optional<std::size_t>> targets;
+
+        auto append = [&] (Handler handler) -> Instruction& {
+            Instruction& inst = m_instructions.emplace_back();
+            inst.handler = handlers[static_cast<std::size_t>(handler)];
+            targets.emplace_back();
+            return inst;
+        };
+
+        // Decoding stops after unsupported instructions, whose length is
+        // unknown, so it is restarted at each branch target not yet
+        // decoded. The first run starts at offset 0 and is the entry point.
+        std::vector<std::size_t> starts = {0};
+        while (!starts.empty()) {
+            std::size_t offset = starts.back();
+            starts.pop_back();
+            if (offset < code.size() && offset_map[offset] != no_instruction) {
+                continue;
+            }
+
+            while (true) {
+                if (offset >= code.size()) {
+                    // Reached if code finishes executing without `return`.
+                    append(Handler::end);
+                    break;
+                }
+                if (offset_map[offset] != no_instruction) {
+                    // Falls through into a previously decoded run.
+                    append(Handler::Goto);
+                    targets.back() = offset;
+                    break;
+                }
+
+                Decoded decoded = decode(cls, &code[offset], offset);
+                if (decoded.length > code.size() - offset) {
+                    decoded = Decoded();
+                    decoded.handler = Handler::error;
+                    decoded.message = "Truncated instruction";
+                    decoded.length = 0;
+                }
+                offset_map[offset] = m_instructions.size();
+
+                if (decoded.target) {
+                    starts.push_back(*decoded.target);
+                }
+
+                // Backward branches are counted whether or not they are
+                // taken.
+                if (decoded.target && *decoded.target <= offset) {
+                    Instruction& inst = append(Handler::backedge);
+                    inst.index = *decoded.target;
+                    inst.profile = &m_profile;
+                }
+
+                Instruction& inst = append(decoded.handler);
+                inst.index = decoded.index;
+                inst.value = decoded.value;
+                if (decoded.handler == Handler::invokestatic) {
+                    inst.call_site = &m_call_sites.emplace_back(
+                        decoded.index
+                    );
+                }
+                if (decoded.handler == Handler::error) {
+                    inst.index = m_errors.size();
+                    m_errors.push_back(std::move(decoded.message));
+                }
+                targets.back() = decoded.target;
+
+                if (decoded.length == 0) {
+                    break;
+                }
+                offset += decoded.length;
+            }
+        }
+
+        // Branches past the end of the code behave like falling off the
+        // end, as in the basic interpreter.
+        bool past_end = false;
+        for (const auto& target : targets) {
+            if (target && *target >= code.size()) {
+                past_end = true;
+                break;
+            }
+        }
+        std::size_t end = no_instruction;
+        if (past_end) {
+            end = m_instructions.size();
+            append(Handler::end);
+        }
+
+        for (std::size_t i = 0; i < targets.size(); ++i) {
+            if (!targets[i]) {
+                continue;
+            }
+            const std::size_t offset = *targets[i];
+            m_instructions[i].target = &m_instructions[
+                offset < code.size() ? offset_map[offset] : end
+            ];
+        }
+    }
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "call-site.hpp"
+#include "class-file.hpp"
+#include "code-info.hpp"
+#include "typedefs.hpp"
+#include <array>
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fish::java::threaded {
+    /**
+     * Operations understood by the threaded interpreter. Each bytecode
+     * instruction is translated into exactly one of these, with its
+     * operands already decoded.
+     */
+    enum class Handler {
+        iconst,
+        iload,
+        istore,
+        iinc,
+        iadd,
+        isub,
+        imul,
+        ishl,
+        ishr,
+        if_icmpeq,
+        if_icmpne,
+        if_icmpgt,
+        if_icmpge,
+        if_icmplt,
+        if_icmple,
+        ifeq,
+        ifne,
+        ifgt,
+        ifge,
+        iflt,
+        ifle,
+        Goto,
+        invokestatic,
+        print_int,
+        print_char,
+        println_int,
+        println_char,
+        println_void,
+        Return,
+        ireturn,
+        getstatic,
+        pop,
+        backedge,
+        error,
+        unsupported,
+        end,
+    };
+
+    inline constexpr std::size_t nhandlers = (
+        static_cast<std::size_t>(Handler::end) + 1
+    );
+
+    // Maps each Handler to the address of the code that implements it.
+    using HandlerTable = std::array<const void*, nhandlers>;
+
+    class Code;
+
+    struct CallSite : fish::java::CallSite {
+        using fish::java::CallSite::CallSite;
+
+        // Translated code of the target method, set when the call site is
+        // resolved.
+        Code* code = nullptr;
+    };
+
+    // Execution counts of a method, used to decide when to compile it.
+    struct Profile {
+        u64 invocations = 0;
+
+        // Number of backward branches executed.
+        u64 backedges = 0;
+
+        // Entry point of the method's compiled code, if any.
+        const void* native = nullptr;
+
+        // Set once compilation has been attempted, even if it failed.
+        bool compiled = false;
+
+        // Compiled code used for on-stack replacement, by the bytecode
+        // offset of the loop header where it starts. Null if compilation
+        // failed.
+        std::unordered_map<std::size_t, const void*> osr_entries;
+    };
+
+    struct Instruction {
+        const void* handler = nullptr;
+
+        // Local variable index, constant pool index, (for `backedge`)
+        // bytecode offset of the branch target, or (for `error`) index of
+        // the error message in the containing Code.
+        u32 index = 0;
+
+        // Immediate value (constant or increment).
+        s32 value = 0;
+
+        // Branch target, if any.
+        const Instruction* target = nullptr;
+
+        // Call site of `invokestatic`, owned by the containing Code.
+        CallSite* call_site = nullptr;
+
+        // Profile of the containing Code, for `backedge`.
+        Profile* profile = nullptr;
+    };
+
+    class Code {
+        public:
+        Code(
+            const ClassFile& cls, const CodeInfo& code_info,
+            const HandlerTable& handlers
+        );
+
+        // Instructions point into the call site list and the profile.
+        Code(const Code&) = delete;
+        Code& operator=(const Code&) = delete;
+
+        const Instruction* begin() const {
+            return m_instructions.data();
+        }
+
+        std::size_t size() const {
+            return m_instructions.size();
+        }
+
+        Profile& profile() {
+            return m_profile;
+        }
+
+        const Profile& profile() const {
+            return m_profile;
+        }
+
+        // Message of an error found during translation, raised when the
+        // instruction is executed.
+        const std::string& error(std::size_t index) const {
+            return m_errors[index];
+        }
+
+        private:
+        std::vector<Instruction> m_instructions;
+        std::list<CallSite> m_call_sites;
+        Profile m_profile;
+        std::vector<std::string> m_errors;
+    };
+}
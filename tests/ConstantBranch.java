@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// `debug` is always zero, so the branches on it are removed and `step` is
+// known to be 3 throughout the loop, even though it's assigned inside it.
+class ConstantBranch {
+    public static int count(int n) {
+        int debug = 0;
+        int step = 3;
+        int total = 0;
+        for (int i = 0; i < n; ++i) {
+            if (debug != 0) {
+                step = step + 1;
+            }
+            total = total + step * i;
+        }
+        if (step != 3) {
+            System.out.println(-1);
+        }
+        return total;
+    }
+
+    public static void main(String[] args) {
+        System.out.println(count(100));
+        System.out.println(count(30000));
+        System.out.println(count(0));
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Multiplications of the loop counter become variables that are
+// incremented on each iteration. In `scaled`, the loop test is rewritten
+// in terms of `i * 7` and the counter is removed.
+class InductionVariable {
+    public static int scaled(int k) {
+        int total = 0;
+        for (int i = 0; i < 1000; ++i) {
+            total = total + i * 7 + i * k;
+        }
+        return total;
+    }
+
+    public static int down(int n) {
+        int total = 0;
+        for (int i = n; i > 0; i = i - 3) {
+            total = total + i * 30000;
+        }
+        return total;
+    }
+
+    public static void main(String[] args) {
+        // Not a constant, which would need `ldc`. `i * k` overflows.
+        int k = 30000;
+        System.out.println(scaled(3));
+        System.out.println(scaled(k * 30));
+        System.out.println(scaled(-5));
+        System.out.println(down(30000));
+        System.out.println(down(0));
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Small helpers called in a loop are inlined into their callers,
+// including helpers that call other helpers.
+class InlineHelper {
+    public static int square(int x) {
+        return x * x;
+    }
+
+    public static int max(int a, int b) {
+        if (a > b) {
+            return a;
+        }
+        return b;
+    }
+
+    public static int clampedSquare(int x, int limit) {
+        return max(square(x) - limit, 0);
+    }
+
+    public static void main(String[] args) {
+        int total = 0;
+        for (int i = 0; i < 30000; ++i) {
+            total = total + clampedSquare(i, 5000) + max(i, 100);
+        }
+        System.out.println(total);
+        System.out.println(clampedSquare(-7, 10));
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Int arithmetic must wrap around in compiled code as in the interpreter.
+class IntOverflow {
+    public static int hash(int n) {
+        int h = 17;
+        for (int i = 0; i < n; ++i) {
+            h = h * 31 + i;
+            h = h - (h << 5) + (h >> 3);
+        }
+        return h;
+    }
+
+    // Only the low 5 bits of the shift distance are used.
+    public static int shift(int x, int n) {
+        return (x << n) + (x >> n);
+    }
+
+    public static void main(String[] args) {
+        int total = 0;
+        for (int i = 0; i < 2000; ++i) {
+            total = total * 7 + hash(i) + shift(i + 30000, i);
+        }
+        System.out.println(total);
+
+        // Not a constant, which would need `ldc`.
+        int one = 1;
+        int max = one << 30;
+        max = max + (max - 1);
+        System.out.println(max + 1);
+        System.out.println(hash(30000));
+    }
+}
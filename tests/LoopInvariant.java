@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// The loop bounds, `scale * scale`, and `x >> 1` don't change in their
+// loops, so they're computed once before them.
+class LoopInvariant {
+    public static int sum(int n, int scale) {
+        int total = 0;
+        for (int i = 0; i < n * scale; ++i) {
+            total = total + i + scale * scale;
+        }
+        return total;
+    }
+
+    public static int divisors(int x) {
+        int count = 0;
+        for (int i = 1; i <= x >> 1; ++i) {
+            int rest = x;
+            while (rest >= i) {
+                rest = rest - i;
+            }
+            if (rest == 0) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    public static void main(String[] args) {
+        int total = 0;
+        for (int n = 0; n < 1500; ++n) {
+            total = total + sum(n, 3);
+        }
+        System.out.println(total);
+        System.out.println(sum(1000, -2));
+        total = 0;
+        for (int x = 0; x < 300; ++x) {
+            total = total + divisors(x);
+        }
+        System.out.println(total);
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// The loop runs long enough to continue in compiled code after on-stack
+// replacement, with values that have already overflowed.
+class OsrOverflow {
+    public static void main(String[] args) {
+        int x = 1;
+        int negative = 0;
+        for (int i = 0; i < 30000; ++i) {
+            x = x * 3 + (i << 29);
+            if (x < 0) {
+                ++negative;
+            }
+        }
+        System.out.println(x);
+        System.out.println(negative);
+    }
+}
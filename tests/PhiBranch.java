@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Each loop's header branches straight to the block after the `if`, where
+// `total` has a phi. The phi is assigned before the header branches, so it
+// must not take the register of `shift`, which the loop still needs.
+class PhiBranch {
+    public static int sink(int value) {
+        return value * 3 + 1;
+    }
+
+    public static int shifted(int shift, int n, int start) {
+        int total = start;
+        if (n > 0) {
+            for (int i = 0; i < n; ++i) {
+                total = total + (start << shift);
+                start = start + 1;
+            }
+        }
+        return sink(total);
+    }
+
+    // Enough values are live in the loop that the phi isn't combined
+    // with `total` in the loop.
+    public static int mixed(int shift, int n, int a, int b, int c, int d) {
+        int s0 = a;
+        int s1 = b;
+        int s2 = c;
+        int s3 = d;
+        int total = a;
+        if (n > 0) {
+            for (int i = 0; i < n; ++i) {
+                s0 = s0 + (s1 << shift);
+                s1 = s1 - (s2 >> shift);
+                s2 = s2 + s3 * c;
+                s3 = s3 - (s0 << shift);
+                total = total + s0 + s1 + s2 + s3 + a * b + c * d;
+            }
+        }
+        return sink(total);
+    }
+
+    public static void main(String[] args) {
+        int total = 0;
+        for (int i = 0; i < 2000; ++i) {
+            total = total + shifted(i >> 8, 11, i);
+            total = total + shifted(3, i >> 10, i);
+            total = total + mixed(i >> 9, 11, i, 5, -3, 7);
+        }
+        System.out.println(total);
+        System.out.println(shifted(2, 11, 1));
+        System.out.println(mixed(1, 11, 2, 3, 4, 5));
+    }
+}
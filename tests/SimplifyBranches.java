@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Empty branches leave blocks that only jump, and a branch whose targets
+// are the same block, which are removed.
+class SimplifyBranches {
+    public static int classify(int x) {
+        int result = 0;
+        if (x < 0) {
+        }
+        else if (x == 0) {
+            result = 1;
+        }
+        else {
+            if (x > 100) {
+            }
+            result = 2;
+        }
+        return result;
+    }
+
+    public static void main(String[] args) {
+        int total = 0;
+        for (int i = -50; i < 150; ++i) {
+            total = total * 3 + classify(i);
+        }
+        System.out.println(total);
+        System.out.println(classify(0));
+    }
+}
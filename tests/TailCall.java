@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Calls whose result is returned right away don't grow the stack: `sum`
+// becomes a loop, and `even` and `odd` jump to each other. The depth stays
+// below the interpreter's limit, which doesn't do this. `seven` has an odd
+// number of arguments passed on the stack, so it calls `report` normally,
+// which keeps the stack aligned for the output functions `report` calls.
+class TailCall {
+    public static int sum(int n, int total) {
+        if (n == 0) {
+            return total;
+        }
+        return sum(n - 1, total + n);
+    }
+
+    public static int even(int n) {
+        if (n == 0) {
+            return 1;
+        }
+        return odd(n - 1);
+    }
+
+    public static int odd(int n) {
+        if (n == 0) {
+            return 0;
+        }
+        return even(n - 1);
+    }
+
+    public static int report(int n) {
+        System.out.println(n);
+        return n * 2;
+    }
+
+    public static int seven(int a, int b, int c, int d, int e, int f, int g) {
+        return report(a + b + c + d + e + f + g);
+    }
+
+    public static void main(String[] args) {
+        System.out.println(sum(30000, 0));
+        System.out.println(sum(10, -5));
+        System.out.println(even(30000));
+        System.out.println(even(30001));
+        System.out.println(seven(1, 2, 3, 4, 5, 6, 7));
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2019 taylor.fish <contact@taylor.fish>
+ *
+ * This file is part of java-compiler.
+ *
+ * java-compiler is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * java-compiler is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with java-compiler. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// `a * b + 7` is computed once and reused in both branches.
+class ValueNumbering {
+    public static int mix(int a, int b) {
+        int x = a * b + 7;
+        int y = 0;
+        if (a > b) {
+            y = a * b + 7;
+        }
+        else {
+            y = (a * b + 7) << 1;
+        }
+        return x + y;
+    }
+
+    public static void main(String[] args) {
+        int total = 0;
+        for (int i = 0; i < 20000; ++i) {
+            total = total + mix(i, 10000);
+        }
+        System.out.println(total);
+        System.out.println(mix(-3, 5));
+    }
+}